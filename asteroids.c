@@ -3,6 +3,7 @@
  */
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <windows.h>
 #include <dsound.h>
@@ -23,8 +24,13 @@
 #define FRAMERATE 60
 #define PI 0x1.921fb6p+1f
 
+// Non-zero to exit with this status without a dialog, for unattended
+// worker processes that nobody is around to dismiss
+static int fatal_quiet;
+
 #define FATAL(msg)                                      \
     do {                                                \
+        if (fatal_quiet) ExitProcess(fatal_quiet);      \
         MessageBoxA(0, msg, "Fatal Error", MB_OK);      \
         ExitProcess(-1);                                \
     } while (0)
@@ -41,6 +47,10 @@
 #define SHOT_COOLDOWN   0.2f
 #define DEBRIS_TTL      1.2f
 
+#define MAX_ASTEROIDS   1024
+#define MAX_SHOTS       64
+#define MAX_DEBRIS      1024
+
 #define AUDIO_HZ        8000
 #define AUDIO_LEN       8*AUDIO_HZ*2
 
@@ -53,6 +63,7 @@
 #define ASTEROID2_MIN   0.008f
 #define ASTEROID2_MAX   0.015f
 #define ASTEROID2_SCORE 5
+#define ASTEROID_SHAPES 256
 
 enum asteroid_size {A0, A1, A2};
 
@@ -105,39 +116,579 @@ uepoch(void)
     return ((hi<<32 | lo)/10 - 11644473600000000) / 1e6;
 }
 
-static unsigned long long rng;
+/* Counter-based random numbers: the Nth value of a stream is a pure
+ * function of the stream's key and N. Values can be drawn in any order,
+ * on any thread, or several at once in SIMD lanes, always with the same
+ * results. Keys derive from the game seed and whatever identifies the
+ * consumer: a tick, a level and entity, a death, a destroyed asteroid.
+ */
+enum stream_id {
+    STREAM_TICK, STREAM_LEVEL, STREAM_DEATH, STREAM_SHAPES, STREAM_SPLIT
+};
+
+struct stream {
+    uint32_t k0, k1;
+    uint32_t n;  // next counter
+};
 
-static unsigned long
-rand32(void)
+static struct stream
+stream_key(uint64_t seed, enum stream_id id, uint64_t index)
 {
-    rng = rng*0x7c3c3267d015ceb5 + 1;
-    unsigned long r = rng>>32 & 0xffffffff;
-    r ^= r>>16;
-    r *= 0x60857ba9;
-    r &= 0xffffffff;
-    r ^= r>>16;
-    return r;
+    uint64_t h = seed;
+    h = (h ^ id)    * 0x9e3779b97f4a7c15; h ^= h >> 32;
+    h = (h ^ index) * 0xd6e8feb86659fd93; h ^= h >> 32;
+    h = h           * 0xd6e8feb86659fd93; h ^= h >> 32;
+    struct stream s = {h, h >> 32, 0};
+    return s;
+}
+
+/* Bijective 32-bit integer hash ("lowbias32"). */
+static uint32_t
+rng_mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t
+stream_at(const struct stream *s, uint32_t n)
+{
+    return rng_mix(rng_mix(n + s->k0) ^ s->k1);
+}
+
+static uint32_t
+stream_u32(struct stream *s)
+{
+    return stream_at(s, s->n++);
 }
 
+/* Uniform float in [0, 1). Uses the top 24 bits, since more would round
+ * and might produce 1.0f.
+ */
+static float
+stream_f(struct stream *s)
+{
+    return (stream_u32(s) >> 8) * 0x1p-24f;
+}
+
+/* The simulation's stream, rekeyed every tick. */
+static struct stream rng;
+
 static float
 randu(void)
 {
-    return rand32() / 4294967296.0f;
+    return stream_f(&rng);
+}
+
+/* Math kernels for the hot paths, scalar and batched. They're accurate
+ * over the inputs the game produces, which are nowhere near the limits:
+ * |x| < 2^23 for ffloor() and wrap(), |a| < 2^12 for cisv().
+ */
+#define CIS_MAX_ERROR 3e-7f  // absolute, verified by -mathcheck
+
+static float
+ffloor(float x)
+{
+    float f = (float)(int)x;
+    return f - (float)(f > x);
+}
+
+/* Wrap X onto the unit torus [0, 1). */
+static float
+wrap(float x)
+{
+    float r = x - ffloor(x);
+    return r - (float)(r >= 1.0f);  // tiny negative x rounds up to 1
+}
+
+/* Wrap angle A onto [0, 2*PI). */
+static float
+wrap_angle(float a)
+{
+    return 2*PI * wrap(a * (1/(2*PI)));
+}
+
+/* Positions on the unit torus and velocities across it. Building with
+ * -DFIXED_TORUS makes positions 32-bit fractions of the torus, so that
+ * wrapping is integer overflow and the signed difference of two
+ * positions is the shortest delta between them. Velocities are then
+ * 2^-28 torus/second (range +/-8), and integration is exact integer
+ * arithmetic independent of compiler and floating point settings.
+ */
+#ifdef FIXED_TORUS
+#define COORD_NAME "fixed-point"
+typedef uint32_t coord;
+typedef int32_t velocity;
+
+static coord
+coord_of(float x)
+{
+    return (coord)(int64_t)(x * 0x1p32f);
+}
+
+static float
+coord_f(coord x)
+{
+    return x * 0x1p-32f;
+}
+
+/* Return X displaced by D, a distance in torus units. */
+static coord
+coord_add(coord x, float d)
+{
+    return x + coord_of(d);
+}
+
+/* Shortest signed distance from B to A. */
+static float
+coord_delta(coord a, coord b)
+{
+    return (int32_t)(a - b) * 0x1p-32f;
+}
+
+static coord
+coord_move(coord x, velocity v, float dt)
+{
+    int64_t t = dt * 0x1p32f;  // seconds, 2^-32 units
+    return x + (coord)(v*t >> 28);
+}
+
+static velocity
+velocity_of(float v)
+{
+    return v * 0x1p28f;
+}
+
+static float
+velocity_f(velocity v)
+{
+    return v * 0x1p-28f;
+}
+
+static velocity
+velocity_scale(velocity v, float f)
+{
+    return (double)v * (double)f;
+}
+#else
+#define COORD_NAME "float"
+typedef float coord;
+typedef float velocity;
+static coord coord_of(float x)                         { return x; }
+static float coord_f(coord x)                          { return x; }
+static coord coord_add(coord x, float d)               { return x + d; }
+static float coord_delta(coord a, coord b)             { return a - b; }
+static velocity velocity_of(float v)                   { return v; }
+static float velocity_f(velocity v)                    { return v; }
+static velocity velocity_scale(velocity v, float f)    { return v * f; }
+
+static coord
+coord_move(coord x, velocity v, float dt)
+{
+    return wrap(x + dt*v);
+}
+#endif
+
+/* Names the simulation for session headers. Even fixed-point builds aim
+ * and spawn through float math and the CRT's sinf/cosf, so results also
+ * depend on the compiler, its floating point flags, and the target.
+ */
+#if defined(__clang__)
+#  define SIM_COMPILER "clang"
+#elif defined(__GNUC__)
+#  define SIM_COMPILER "gcc"
+#elif defined(_MSC_VER)
+#  define SIM_COMPILER "msvc"
+#else
+#  define SIM_COMPILER "cc"
+#endif
+#ifdef __FAST_MATH__
+#  define SIM_MATH "fast-math"
+#else
+#  define SIM_MATH "ieee"
+#endif
+#if defined(_WIN64) || defined(__x86_64__)
+#  define SIM_ARCH "x64"
+#else
+#  define SIM_ARCH "x86"
+#endif
+#define SIM_NAME COORD_NAME "/" SIM_COMPILER "/" SIM_MATH "/" SIM_ARCH
+
+/* Unit vector at angle A: {cos(a), sin(a)}. One at a time, libm's
+ * sincosf measures faster than the polynomial below (-mathcheck), so
+ * the polynomial only runs in batches.
+ */
+static struct v2
+cis(float a)
+{
+    struct v2 v = {cosf(a), sinf(a)};
+    return v;
+}
+
+/* Polynomials for sin and cos over [-PI/4, PI/4] (Cephes). Argument
+ * reduction is done in double precision since -ffast-math is free to
+ * reassociate a float Cody-Waite reduction and ruin it.
+ */
+#define CIS_S3 -1.6666654611e-1f
+#define CIS_S5 +8.3321608736e-3f
+#define CIS_S7 -1.9515295891e-4f
+#define CIS_C4 +4.166664568298827e-2f
+#define CIS_C6 -1.388731625493765e-3f
+#define CIS_C8 +2.443315711809948e-5f
+#define PIO2   1.57079632679489662
+
+/* FNV-1a over LEN bytes, continuing from H. */
+#define HASH_INIT 0xcbf29ce484222325
+
+static uint64_t
+hash64(uint64_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+/* Bulk hash for large buffers: eight 32-bit lanes, each an FNV-1a
+ * variant over every eighth word, folded into H along with the
+ * trailing bytes. Unlike hash64() it vectorizes, but its values differ.
+ */
+#define HASHV_LANES 8
+#define HASHV_BLOCK (4*HASHV_LANES)
+#define HASHV_INIT  0x811c9dc5
+#define HASHV_PRIME 0x01000193
+
+/* Advance all lanes X over one block at P. */
+static void
+hashv_block(uint32_t *x, const unsigned char *p)
+{
+    for (int i = 0; i < HASHV_LANES; i++) {
+        uint32_t w;
+        memcpy(&w, p + 4*i, 4);
+        x[i] = (x[i] ^ w) * HASHV_PRIME;
+        x[i] ^= x[i] >> 13;
+    }
+}
+
+static uint64_t
+hashv_fold(uint64_t h, const uint32_t *x, const unsigned char *p, size_t len)
+{
+    for (int i = 0; i < HASHV_LANES; i++) {
+        h ^= x[i];
+        h *= 0x100000001b3;
+    }
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Batch wrap() in place. */
+static void
+wrapv(float *x, int n)
+{
+    int i = 0;
+#ifdef __AVX2__
+    for (; i+8 <= n; i += 8) {
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m256 r = _mm256_sub_ps(v, _mm256_floor_ps(v));
+        __m256 over = _mm256_cmp_ps(r, one, _CMP_GE_OQ);
+        _mm256_storeu_ps(x + i, _mm256_sub_ps(r, _mm256_and_ps(over, one)));
+    }
+#endif
+    for (; i+4 <= n; i += 4) {
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 v = _mm_loadu_ps(x + i);
+        __m128 f = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        f = _mm_sub_ps(f, _mm_and_ps(_mm_cmpgt_ps(f, v), one));
+        __m128 r = _mm_sub_ps(v, f);
+        r = _mm_sub_ps(r, _mm_and_ps(_mm_cmpge_ps(r, one), one));
+        _mm_storeu_ps(x + i, r);
+    }
+    for (; i < n; i++) {
+        x[i] = wrap(x[i]);
+    }
+}
+
+/* Batch cis(), four or eight lanes at a time, into separate cos and sin
+ * arrays.
+ */
+static void
+cisv(float *c, float *s, const float *a, int n)
+{
+    int i = 0;
+#ifdef __AVX2__
+    for (; i+8 <= n; i += 8) {
+        __m256i one = _mm256_set1_epi32(1);
+        __m256i two = _mm256_set1_epi32(2);
+        __m256 x = _mm256_loadu_ps(a + i);
+        __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(2/PI)));
+        __m256d pio2 = _mm256_set1_pd(PIO2);
+        __m256d lo = _mm256_sub_pd(
+            _mm256_cvtps_pd(_mm256_castps256_ps128(x)),
+            _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(q)), pio2)
+        );
+        __m256d hi = _mm256_sub_pd(
+            _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)),
+            _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(q, 1)),
+                          pio2)
+        );
+        __m256 r = _mm256_castps128_ps256(_mm256_cvtpd_ps(lo));
+        r = _mm256_insertf128_ps(r, _mm256_cvtpd_ps(hi), 1);
+        __m256 z = _mm256_mul_ps(r, r);
+
+        __m256 sp = _mm256_add_ps(_mm256_set1_ps(CIS_S5),
+                                  _mm256_mul_ps(z, _mm256_set1_ps(CIS_S7)));
+        sp = _mm256_add_ps(_mm256_set1_ps(CIS_S3), _mm256_mul_ps(z, sp));
+        sp = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, z), sp));
+
+        __m256 cp = _mm256_add_ps(_mm256_set1_ps(CIS_C6),
+                                  _mm256_mul_ps(z, _mm256_set1_ps(CIS_C8)));
+        cp = _mm256_add_ps(_mm256_set1_ps(CIS_C4), _mm256_mul_ps(z, cp));
+        cp = _mm256_mul_ps(_mm256_mul_ps(z, z), cp);
+        cp = _mm256_sub_ps(cp, _mm256_mul_ps(_mm256_set1_ps(0.5f), z));
+        cp = _mm256_add_ps(_mm256_set1_ps(1.0f), cp);
+
+        __m256i odd = _mm256_cmpeq_epi32(_mm256_and_si256(q, one), one);
+        __m256 swap = _mm256_castsi256_ps(odd);
+        __m256 sv = _mm256_blendv_ps(sp, cp, swap);
+        __m256 cv = _mm256_blendv_ps(cp, sp, swap);
+        __m256i ssign = _mm256_slli_epi32(_mm256_and_si256(q, two), 30);
+        __m256i csign = _mm256_add_epi32(q, one);
+        csign = _mm256_slli_epi32(_mm256_and_si256(csign, two), 30);
+        _mm256_storeu_ps(s + i, _mm256_xor_ps(sv, _mm256_castsi256_ps(ssign)));
+        _mm256_storeu_ps(c + i, _mm256_xor_ps(cv, _mm256_castsi256_ps(csign)));
+    }
+#endif
+    for (; i+4 <= n; i += 4) {
+        __m128i one = _mm_set1_epi32(1);
+        __m128i two = _mm_set1_epi32(2);
+        __m128 x = _mm_loadu_ps(a + i);
+        __m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(2/PI)));
+        __m128d pio2 = _mm_set1_pd(PIO2);
+        __m128d lo = _mm_sub_pd(_mm_cvtps_pd(x),
+                                _mm_mul_pd(_mm_cvtepi32_pd(q), pio2));
+        __m128 xhi = _mm_movehl_ps(x, x);
+        __m128i qhi = _mm_shuffle_epi32(q, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128d hi = _mm_sub_pd(_mm_cvtps_pd(xhi),
+                                _mm_mul_pd(_mm_cvtepi32_pd(qhi), pio2));
+        __m128 r = _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+        __m128 z = _mm_mul_ps(r, r);
+
+        __m128 sp = _mm_add_ps(_mm_set1_ps(CIS_S5),
+                               _mm_mul_ps(z, _mm_set1_ps(CIS_S7)));
+        sp = _mm_add_ps(_mm_set1_ps(CIS_S3), _mm_mul_ps(z, sp));
+        sp = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, z), sp));
+
+        __m128 cp = _mm_add_ps(_mm_set1_ps(CIS_C6),
+                               _mm_mul_ps(z, _mm_set1_ps(CIS_C8)));
+        cp = _mm_add_ps(_mm_set1_ps(CIS_C4), _mm_mul_ps(z, cp));
+        cp = _mm_mul_ps(_mm_mul_ps(z, z), cp);
+        cp = _mm_sub_ps(cp, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+        cp = _mm_add_ps(_mm_set1_ps(1.0f), cp);
+
+        __m128i odd = _mm_cmpeq_epi32(_mm_and_si128(q, one), one);
+        __m128 swap = _mm_castsi128_ps(odd);
+        __m128 sv = _mm_or_ps(_mm_and_ps(swap, cp), _mm_andnot_ps(swap, sp));
+        __m128 cv = _mm_or_ps(_mm_and_ps(swap, sp), _mm_andnot_ps(swap, cp));
+        __m128i ssign = _mm_slli_epi32(_mm_and_si128(q, two), 30);
+        __m128i csign = _mm_add_epi32(q, one);
+        csign = _mm_slli_epi32(_mm_and_si128(csign, two), 30);
+        _mm_storeu_ps(s + i, _mm_xor_ps(sv, _mm_castsi128_ps(ssign)));
+        _mm_storeu_ps(c + i, _mm_xor_ps(cv, _mm_castsi128_ps(csign)));
+    }
+    for (; i < n; i++) {
+        struct v2 v = cis(a[i]);
+        c[i] = v.x;
+        s[i] = v.y;
+    }
+}
+
+/* Low 32 bits of each lane product, which SSE2 lacks. */
+static __m128i
+mullo32(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    even = _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0));
+    odd = _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0));
+    return _mm_unpacklo_epi32(even, odd);
+}
+
+static __m128i
+rng_mixv(__m128i x)
+{
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = mullo32(x, _mm_set1_epi32(0x7feb352d));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = mullo32(x, _mm_set1_epi32((int)0x846ca68b));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    return x;
+}
+
+#ifdef __AVX2__
+static __m256i
+rng_mixv8(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68b));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    return x;
+}
+#endif
+
+/* Batch stream_f(), four or eight lanes at a time, drawing the next N
+ * values.
+ */
+static void
+stream_fill(struct stream *s, float *dst, int n)
+{
+    int i = 0;
+#ifdef __AVX2__
+    __m256i k0x8 = _mm256_set1_epi32(s->k0);
+    __m256i k1x8 = _mm256_set1_epi32(s->k1);
+    for (; i+8 <= n; i += 8) {
+        __m256i ctr = _mm256_add_epi32(_mm256_set1_epi32(s->n + i),
+                                       _mm256_setr_epi32(0, 1, 2, 3,
+                                                         4, 5, 6, 7));
+        __m256i x = rng_mixv8(_mm256_add_epi32(ctr, k0x8));
+        x = rng_mixv8(_mm256_xor_si256(x, k1x8));
+        __m256 f = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(f, _mm256_set1_ps(0x1p-24f)));
+    }
+#endif
+    __m128i k0 = _mm_set1_epi32(s->k0);
+    __m128i k1 = _mm_set1_epi32(s->k1);
+    for (; i+4 <= n; i += 4) {
+        __m128i ctr = _mm_add_epi32(_mm_set1_epi32(s->n + i),
+                                    _mm_setr_epi32(0, 1, 2, 3));
+        __m128i x = rng_mixv(_mm_add_epi32(ctr, k0));
+        x = rng_mixv(_mm_xor_si128(x, k1));
+        __m128 f = _mm_cvtepi32_ps(_mm_srli_epi32(x, 8));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(f, _mm_set1_ps(0x1p-24f)));
+    }
+    s->n += i;
+    for (; i < n; i++) {
+        dst[i] = stream_f(s);
+    }
+}
+
+/* Hash LEN bytes at BUF into H with all lanes in vector registers. */
+static uint64_t
+hashv(uint64_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    size_t nblocks = len / HASHV_BLOCK;
+    uint32_t x[HASHV_LANES];
+#ifdef __AVX2__
+    __m256i prime = _mm256_set1_epi32(HASHV_PRIME);
+    __m256i v = _mm256_add_epi32(_mm256_set1_epi32(HASHV_INIT),
+                                 _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    for (size_t i = 0; i < nblocks; i++) {
+        __m256i w = _mm256_loadu_si256((void *)(p + i*HASHV_BLOCK));
+        v = _mm256_mullo_epi32(_mm256_xor_si256(v, w), prime);
+        v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 13));
+    }
+    _mm256_storeu_si256((void *)x, v);
+#else
+    __m128i prime = _mm_set1_epi32(HASHV_PRIME);
+    __m128i v0 = _mm_add_epi32(_mm_set1_epi32(HASHV_INIT),
+                               _mm_setr_epi32(0, 1, 2, 3));
+    __m128i v1 = _mm_add_epi32(v0, _mm_set1_epi32(4));
+    for (size_t i = 0; i < nblocks; i++) {
+        const __m128i *w = (void *)(p + i*HASHV_BLOCK);
+        v0 = mullo32(_mm_xor_si128(v0, _mm_loadu_si128(w+0)), prime);
+        v1 = mullo32(_mm_xor_si128(v1, _mm_loadu_si128(w+1)), prime);
+        v0 = _mm_xor_si128(v0, _mm_srli_epi32(v0, 13));
+        v1 = _mm_xor_si128(v1, _mm_srli_epi32(v1, 13));
+    }
+    _mm_storeu_si128((void *)(x+0), v0);
+    _mm_storeu_si128((void *)(x+4), v1);
+#endif
+    p += nblocks * HASHV_BLOCK;
+    return hashv_fold(h, x, p, len % HASHV_BLOCK);
+}
+#else
+static void
+wrapv(float *x, int n)
+{
+    for (int i = 0; i < n; i++) {
+        x[i] = wrap(x[i]);
+    }
+}
+
+static void
+cisv(float *c, float *s, const float *a, int n)
+{
+    for (int i = 0; i < n; i++) {
+        struct v2 v = cis(a[i]);
+        c[i] = v.x;
+        s[i] = v.y;
+    }
+}
+
+static void
+stream_fill(struct stream *s, float *dst, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] = stream_f(s);
+    }
+}
+
+static uint64_t
+hashv(uint64_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    uint32_t x[HASHV_LANES];
+    for (int i = 0; i < HASHV_LANES; i++) {
+        x[i] = HASHV_INIT + i;
+    }
+    for (; len >= HASHV_BLOCK; len -= HASHV_BLOCK, p += HASHV_BLOCK) {
+        hashv_block(x, p);
+    }
+    return hashv_fold(h, x, p, len);
 }
+#endif
 
 struct tf { float c, s, tx, ty; };
 
 static struct tf
 tf(float a, float tx, float ty)
 {
+    struct v2 r = cis(a);
     struct tf tf = {
-        .c = cosf(a),
-        .s = sinf(a),
+        .c = r.x,
+        .s = r.y,
         .tx = tx, .ty = ty,
     };
     return tf;
 }
 
+/* Uniformly scale the transform's rotation component. */
+static struct tf
+tf_scale(struct tf tf, float scale)
+{
+    tf.c *= scale;
+    tf.s *= scale;
+    return tf;
+}
+
 static struct v2
 tf_apply(struct tf tf, struct v2 v)
 {
@@ -165,90 +716,259 @@ lltostr(char *buf, long long n)
 
 static void win32_audio_mix(int16_t *buf, size_t len);
 static void win32_audio_clear(size_t len);
+static void *win32_alloc(size_t len);
+static double counter_freq(void);
+static double counter_now(void);
+static void capture_sound(const int16_t *pcm, int len);
 
-static int g_nlines;
-static struct {
+struct g_vertex {
     GLubyte r, g, b, a;
     GLfloat x, y;
-} g_linebuf[1<<16];
+};
+static int g_nlines;
+static struct g_vertex g_linebuf[1<<16];  // indexed by g_indexbuf
+static int g_nindices;
+static GLushort g_indexbuf[1<<17];       // pairs of line endpoints
 static int g_npoints;
-static struct {
-    GLubyte r, g, b, a;
-    GLfloat x, y;
-} g_pointbuf[1<<10];
+static struct g_vertex g_pointbuf[1<<10];
+static int g_ndots;
+static struct g_vertex g_dotbuf[1<<10];  // line-width points
+static long long g_vertextotal;          // total submitted
+static long long g_indextotal;           // total submitted
+
+/* Level of detail, derived from the window size at init */
+#define LOD_SEGMENT 3.0f                 // minimum outline segment, pixels
+static BOOL g_nolod;
+static BOOL g_nogpu;
+static float g_pixel;                    // pixel size in world units
+static float g_linewidth;                // in pixels
+static float g_pointsize;                // in pixels
+
+/* Headless rendering skips OpenGL, instead hashing the buffers and
+ * optionally rasterizing them on the CPU.
+ */
+static BOOL g_headless;
+static uint64_t g_hash;                  // of everything flushed
+static int g_rsize;                      // raster width and height
+static uint8_t *g_raster;                // RGB, top row first
 
 static const signed char toroid[][2] = {
     {+0, +0}, {-1, +0}, {+1, +0}, {+0, -1}, {+0, +1}
 };
 
-/* Push line segment onto rendering buffer. */
 static void
-g_line(struct v2 a, struct v2 b, uint32_t color)
+g_rplot(int x, int y, const struct g_vertex *c)
 {
-    int i = g_nlines;
-    g_nlines += 2;
-    g_linebuf[i+0].r = color >> 16;
-    g_linebuf[i+0].g = color >>  8;
-    g_linebuf[i+0].b = color >>  0;
-    g_linebuf[i+0].a = color >> 24;
-    g_linebuf[i+0].x = 2*a.x - 1;
-    g_linebuf[i+0].y = 2*a.y - 1;
-    g_linebuf[i+1].r = color >> 16;
-    g_linebuf[i+1].g = color >>  8;
-    g_linebuf[i+1].b = color >>  0;
-    g_linebuf[i+1].a = color >> 24;
-    g_linebuf[i+1].x = 2*b.x - 1;
-    g_linebuf[i+1].y = 2*b.y - 1;
+    if (x < 0 || x >= g_rsize || y < 0 || y >= g_rsize) return;
+    uint8_t *p = g_raster + ((g_rsize - 1 - y)*g_rsize + x)*3;
+    p[0] += (c->r - p[0]) * c->a / 255;
+    p[1] += (c->g - p[1]) * c->a / 255;
+    p[2] += (c->b - p[2]) * c->a / 255;
 }
 
-/* Push toroid-wrapped line segment onto the rendering buffer. */
 static void
-g_wline(struct v2 a, struct v2 b, uint32_t color)
+g_rline(const struct g_vertex *a, const struct g_vertex *b)
 {
-    for (int i = 0; i < 5; i++) {
-        float tx = toroid[i][0];
-        float ty = toroid[i][1];
-        struct v2 ta = {a.x+tx, a.y+ty};
-        struct v2 tb = {b.x+tx, b.y+ty};
-        g_line(ta, tb, color);
+    float x0 = (a->x + 1) * g_rsize/2;
+    float y0 = (a->y + 1) * g_rsize/2;
+    float dx = (b->x - a->x) * g_rsize/2;
+    float dy = (b->y - a->y) * g_rsize/2;
+    float len = fabsf(dx) > fabsf(dy) ? fabsf(dx) : fabsf(dy);
+    int n = len + 1;
+    for (int i = 0; i <= n; i++) {
+        float t = (float)i / n;
+        g_rplot(ffloor(x0 + t*dx), ffloor(y0 + t*dy), a);
     }
 }
 
 static void
-g_wlinestrip(const struct v2 *v, int n, struct tf tf, uint32_t color)
+g_rpoint(const struct g_vertex *v, float size)
 {
-    struct v2 a = tf_apply(tf, v[0]);
-    for (int i = 1; i < n; i++) {
-        struct v2 b = tf_apply(tf, v[i]);
-        g_wline(a, b, color);
-        a = b;
+    int n = size < 1 ? 1 : size;
+    int x0 = ffloor((v->x + 1)*g_rsize/2 - n/2.0f + 0.5f);
+    int y0 = ffloor((v->y + 1)*g_rsize/2 - n/2.0f + 0.5f);
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            g_rplot(x0 + x, y0 + y, v);
+        }
+    }
+}
+
+/* Clear the frame to the background color. */
+static void
+g_clear(void)
+{
+    if (g_raster) {
+        memset(g_raster, 0x1a, g_rsize*g_rsize*3);
+    }
+    if (!g_headless) {
+        glClear(GL_COLOR_BUFFER_BIT);
     }
 }
 
+/* Hash and rasterize the rendering buffers in place of OpenGL. */
 static void
-g_wlineloop(const struct v2 *v, int n, struct tf tf, uint32_t color)
+g_headless_flush(void)
 {
-    g_wlinestrip(v, n, tf, color);
-    g_wline(tf_apply(tf, v[n-1]), tf_apply(tf, v[0]), color);
+    g_hash = hashv(g_hash, g_linebuf, g_nlines*sizeof(*g_linebuf));
+    g_hash = hashv(g_hash, g_indexbuf, g_nindices*sizeof(*g_indexbuf));
+    g_hash = hashv(g_hash, g_pointbuf, g_npoints*sizeof(*g_pointbuf));
+    g_hash = hashv(g_hash, g_dotbuf, g_ndots*sizeof(*g_dotbuf));
+    if (g_raster) {
+        for (int i = 0; i < g_nindices; i += 2) {
+            struct g_vertex *a = g_linebuf + g_indexbuf[i+0];
+            struct g_vertex *b = g_linebuf + g_indexbuf[i+1];
+            g_rline(a, b);
+        }
+        for (int i = 0; i < g_npoints; i++) {
+            g_rpoint(g_pointbuf + i, g_pointsize);
+        }
+        for (int i = 0; i < g_ndots; i++) {
+            g_rpoint(g_dotbuf + i, g_linewidth);
+        }
+    }
+    g_nlines = g_nindices = g_npoints = g_ndots = 0;
 }
 
+/* Draw and empty the rendering buffers. */
 static void
-g_render(void)
+g_flush(void)
 {
-    glClear(GL_COLOR_BUFFER_BIT);
+    g_vertextotal += g_nlines + g_npoints + g_ndots;
+    g_indextotal += g_nindices;
+    if (g_headless) {
+        g_headless_flush();
+        return;
+    }
 
     glInterleavedArrays(GL_C4UB_V2F, 0, g_linebuf);
-    glDrawArrays(GL_LINES, 0, g_nlines);
+    glDrawElements(GL_LINES, g_nindices, GL_UNSIGNED_SHORT, g_indexbuf);
     g_nlines = 0;
+    g_nindices = 0;
 
     glInterleavedArrays(GL_C4UB_V2F, 0, g_pointbuf);
     glDrawArrays(GL_POINTS, 0, g_npoints);
     g_npoints = 0;
+
+    if (g_ndots) {
+        glPointSize(g_linewidth);
+        glInterleavedArrays(GL_C4UB_V2F, 0, g_dotbuf);
+        glDrawArrays(GL_POINTS, 0, g_ndots);
+        glPointSize(g_pointsize);
+        g_ndots = 0;
+    }
+}
+
+/* Return a mask of the toroid replicas in which an object of radius R
+ * at (X, Y) is visible.
+ */
+static int
+g_wmask(float x, float y, float r)
+{
+    if (g_nolod) return (1 << COUNTOF(toroid)) - 1;
+    r += g_linewidth * g_pixel;
+    int mask = 0;
+    for (int i = 0; i < COUNTOF(toroid); i++) {
+        float tx = x + toroid[i][0];
+        float ty = y + toroid[i][1];
+        if (tx + r >= 0 && tx - r <= 1 && ty + r >= 0 && ty - r <= 1) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+/* Push NVERTS line vertices of one color, converted to clip space, and
+ * NINDICES indices relative to the first vertex.
+ */
+static void
+g_lines(const struct v2 *v, int nverts, float tx, float ty, uint32_t color,
+        const GLushort *indices, int nindices)
+{
+    if (g_nlines + nverts > COUNTOF(g_linebuf) ||
+        g_nindices + nindices > COUNTOF(g_indexbuf)) {
+        g_flush();
+    }
+    int base = g_nlines;
+    struct g_vertex *dst = g_linebuf + base;
+    for (int i = 0; i < nverts; i++) {
+        dst[i].r = color >> 16;
+        dst[i].g = color >>  8;
+        dst[i].b = color >>  0;
+        dst[i].a = color >> 24;
+        dst[i].x = v[i].x + tx;
+        dst[i].y = v[i].y + ty;
+    }
+    for (int i = 0; i < nindices; i++) {
+        g_indexbuf[g_nindices+i] = base + indices[i];
+    }
+    g_nlines += nverts;
+    g_nindices += nindices;
+}
+
+/* Indices of a closed loop of up to 16 vertices as line pairs. Strips
+ * use a prefix, and loops replace the final pair's second element.
+ */
+static const GLushort g_loopidx[] = {
+     0,  1,  1,  2,  2,  3,  3,  4,  4,  5,  5,  6,  6,  7,  7,  8,
+     8,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15,  0,
+};
+
+/* Push line segment onto rendering buffer. */
+static void
+g_line(struct v2 a, struct v2 b, uint32_t color)
+{
+    struct v2 v[] = {{2*a.x - 1, 2*a.y - 1}, {2*b.x - 1, 2*b.y - 1}};
+    g_lines(v, 2, 0, 0, color, g_loopidx, 2);
+}
+
+/* Push a toroid-wrapped polyline of up to 16 vertices, transforming
+ * each vertex once and sharing it between its two segments.
+ */
+static void
+g_wpoly(const struct v2 *v, int n, struct tf tf, uint32_t color, int mask,
+        BOOL loop)
+{
+    struct v2 p[16];
+    for (int i = 0; i < n; i++) {
+        p[i] = tf_apply(tf, v[i]);
+        p[i].x = 2*p[i].x - 1;
+        p[i].y = 2*p[i].y - 1;
+    }
+
+    GLushort idx[COUNTOF(g_loopidx)];
+    int nidx = 2*(n - 1);
+    memcpy(idx, g_loopidx, nidx*sizeof(*idx));
+    if (loop) {
+        idx[nidx++] = n - 1;
+        idx[nidx++] = 0;
+    }
+
+    for (int i = 0; i < COUNTOF(toroid); i++) {
+        if (mask & 1<<i) {
+            float tx = 2*toroid[i][0];
+            float ty = 2*toroid[i][1];
+            g_lines(p, n, tx, ty, color, idx, nidx);
+        }
+    }
+}
+
+static void
+g_wlinestrip(const struct v2 *v, int n, struct tf tf, uint32_t color, int mask)
+{
+    g_wpoly(v, n, tf, color, mask, FALSE);
+}
+
+static void
+g_wlineloop(const struct v2 *v, int n, struct tf tf, uint32_t color, int mask)
+{
+    g_wpoly(v, n, tf, color, mask, TRUE);
 }
 
 static void
 g_point(float x, float y, uint32_t color)
 {
+    if (g_npoints == COUNTOF(g_pointbuf)) g_flush();
     int i = g_npoints++;
     g_pointbuf[i].r = color >> 16;
     g_pointbuf[i].g = color >>  8;
@@ -261,44 +981,348 @@ g_point(float x, float y, uint32_t color)
 static void
 g_wpoint(float x, float y, uint32_t color)
 {
-    for (int i = 0; i < 5; i++) {
-        g_point(toroid[i][0] + x, toroid[i][1] + y, color);
+    int mask = g_wmask(x, y, g_pointsize*g_pixel/2);
+    for (int i = 0; i < COUNTOF(toroid); i++) {
+        if (mask & 1<<i) {
+            g_point(toroid[i][0] + x, toroid[i][1] + y, color);
+        }
     }
 }
 
-struct {
-    double last;
-    long level;
-    float transition;
-    long long score;
-    int lives;
-
-    #define I_TURNL  (1<<0)
+/* Push a toroid-wrapped, line-width point, standing in for sub-pixel
+ * geometry.
+ */
+static void
+g_wdot(float x, float y, uint32_t color)
+{
+    int mask = g_wmask(x, y, 0);
+    for (int i = 0; i < COUNTOF(toroid); i++) {
+        if (!(mask & 1<<i)) continue;
+        if (g_ndots == COUNTOF(g_dotbuf)) g_flush();
+        int j = g_ndots++;
+        g_dotbuf[j].r = color >> 16;
+        g_dotbuf[j].g = color >>  8;
+        g_dotbuf[j].b = color >>  0;
+        g_dotbuf[j].a = color >> 24;
+        g_dotbuf[j].x = 2*(toroid[i][0] + x) - 1;
+        g_dotbuf[j].y = 2*(toroid[i][1] + y) - 1;
+    }
+}
+
+/* GPU-evaluated debris: each fragment is uploaded once when spawned,
+ * and a vertex shader computes its motion, spin, wrap, and fade from a
+ * time uniform. Fragments share one lifetime, so as long as spawn times
+ * never decrease, spawn order is expiry order and a ring buffer holds
+ * them. Requires OpenGL 2.0, otherwise
+ * debris falls back to CPU rendering.
+ */
+#ifndef GL_ARRAY_BUFFER
+#  define GL_ARRAY_BUFFER     0x8892
+#  define GL_DYNAMIC_DRAW     0x88e8
+#  define GL_FRAGMENT_SHADER  0x8b30
+#  define GL_VERTEX_SHADER    0x8b31
+#  define GL_COMPILE_STATUS   0x8b81
+#  define GL_LINK_STATUS      0x8b82
+#endif
+
+static void   (APIENTRY *glGenBuffers_p)(GLsizei, GLuint *);
+static void   (APIENTRY *glBindBuffer_p)(GLenum, GLuint);
+static void   (APIENTRY *glBufferData_p)(GLenum, ptrdiff_t, const void *,
+                                         GLenum);
+static void   (APIENTRY *glBufferSubData_p)(GLenum, ptrdiff_t, ptrdiff_t,
+                                            const void *);
+static GLuint (APIENTRY *glCreateShader_p)(GLenum);
+static void   (APIENTRY *glShaderSource_p)(GLuint, GLsizei, const char **,
+                                           const GLint *);
+static void   (APIENTRY *glCompileShader_p)(GLuint);
+static void   (APIENTRY *glGetShaderiv_p)(GLuint, GLenum, GLint *);
+static GLuint (APIENTRY *glCreateProgram_p)(void);
+static void   (APIENTRY *glAttachShader_p)(GLuint, GLuint);
+static void   (APIENTRY *glBindAttribLocation_p)(GLuint, GLuint, const char *);
+static void   (APIENTRY *glLinkProgram_p)(GLuint);
+static void   (APIENTRY *glGetProgramiv_p)(GLuint, GLenum, GLint *);
+static void   (APIENTRY *glUseProgram_p)(GLuint);
+static GLint  (APIENTRY *glGetUniformLocation_p)(GLuint, const char *);
+static void   (APIENTRY *glUniform1f_p)(GLint, GLfloat);
+static void   (APIENTRY *glUniform2f_p)(GLint, GLfloat, GLfloat);
+static void   (APIENTRY *glVertexAttribPointer_p)(GLuint, GLint, GLenum,
+                                                  GLboolean, GLsizei,
+                                                  const void *);
+static void   (APIENTRY *glEnableVertexAttribArray_p)(GLuint);
+static void   (APIENTRY *glDisableVertexAttribArray_p)(GLuint);
+static void  *(APIENTRY *glMapBuffer_p)(GLenum, GLenum);
+static GLboolean (APIENTRY *glUnmapBuffer_p)(GLenum);
+
+static const char g_debris_vert[] =
+    "#version 110\n"
+    "attribute vec4 motion;\n"   // x, y, dx, dy
+    "attribute vec4 shape;\n"    // endpoint x, y, spin rate, spawn time
+    "attribute vec4 color;\n"
+    "uniform float time;\n"
+    "uniform float ttl;\n"
+    "uniform vec2 offset;\n"
+    "varying vec4 fcolor;\n"
+    "void main() {\n"
+    "    float age = time - shape.w;\n"
+    "    float a = age * shape.z;\n"
+    "    mat2 r = mat2(cos(a), sin(a), -sin(a), cos(a));\n"
+    "    vec2 p = fract(motion.xy + age*motion.zw) + r*shape.xy + offset;\n"
+    "    gl_Position = vec4(2.0*p - 1.0, 0.0, 1.0);\n"
+    "    fcolor = vec4(color.rgb, color.a * max(0.0, 1.0 - age/ttl));\n"
+    "}\n";
+
+static const char g_debris_frag[] =
+    "#version 110\n"
+    "varying vec4 fcolor;\n"
+    "void main() {\n"
+    "    gl_FragColor = fcolor;\n"
+    "}\n";
+
+enum {G_MOTION, G_SHAPE, G_COLOR};
+
+static struct {
+    BOOL enabled;
+    GLuint program, vbo;
+    GLint time, ttl, offset;
+    int len;                // ring capacity in fragments
+    int head, tail;         // live fragments
+    int uploaded;           // start of pending fragments
+    long dropped;           // spawns lost to a full ring
+    double epoch;           // time base for spawn times
+    struct {
+        GLfloat x, y, dx, dy;
+        GLfloat vx, vy, da, t0;
+        GLubyte r, g, b, a;
+    } (*ring)[2];
+} g_debris;
+
+static GLuint
+g_shader(GLenum type, const char *src)
+{
+    GLint ok;
+    GLuint shader = glCreateShader_p(type);
+    glShaderSource_p(shader, 1, &src, 0);
+    glCompileShader_p(shader);
+    glGetShaderiv_p(shader, GL_COMPILE_STATUS, &ok);
+    return ok ? shader : 0;
+}
+
+/* Attempt to enable GPU debris with room for LEN fragments. */
+static void
+g_debris_init(int len)
+{
+    #define LOADGL(f) if (!(f##_p = (void *)wglGetProcAddress(#f))) return
+    LOADGL(glGenBuffers);
+    LOADGL(glBindBuffer);
+    LOADGL(glBufferData);
+    LOADGL(glBufferSubData);
+    LOADGL(glCreateShader);
+    LOADGL(glShaderSource);
+    LOADGL(glCompileShader);
+    LOADGL(glGetShaderiv);
+    LOADGL(glCreateProgram);
+    LOADGL(glAttachShader);
+    LOADGL(glBindAttribLocation);
+    LOADGL(glLinkProgram);
+    LOADGL(glGetProgramiv);
+    LOADGL(glUseProgram);
+    LOADGL(glGetUniformLocation);
+    LOADGL(glUniform1f);
+    LOADGL(glUniform2f);
+    LOADGL(glVertexAttribPointer);
+    LOADGL(glEnableVertexAttribArray);
+    LOADGL(glDisableVertexAttribArray);
+    #undef LOADGL
+
+    GLuint vert = g_shader(GL_VERTEX_SHADER, g_debris_vert);
+    GLuint frag = g_shader(GL_FRAGMENT_SHADER, g_debris_frag);
+    if (!vert || !frag) return;
+    GLint ok;
+    GLuint program = glCreateProgram_p();
+    glAttachShader_p(program, vert);
+    glAttachShader_p(program, frag);
+    glBindAttribLocation_p(program, G_MOTION, "motion");
+    glBindAttribLocation_p(program, G_SHAPE,  "shape");
+    glBindAttribLocation_p(program, G_COLOR,  "color");
+    glLinkProgram_p(program);
+    glGetProgramiv_p(program, GL_LINK_STATUS, &ok);
+    if (!ok) return;
+
+    g_debris.program = program;
+    g_debris.time = glGetUniformLocation_p(program, "time");
+    g_debris.ttl = glGetUniformLocation_p(program, "ttl");
+    g_debris.offset = glGetUniformLocation_p(program, "offset");
+    // One slot always empty, plus slack for fragments the simulation
+    // has retired but the next render has not
+    g_debris.len = len + len/8 + 1;
+    g_debris.ring = win32_alloc(g_debris.len * sizeof(*g_debris.ring));
+    glGenBuffers_p(1, &g_debris.vbo);
+    glBindBuffer_p(GL_ARRAY_BUFFER, g_debris.vbo);
+    glBufferData_p(GL_ARRAY_BUFFER, g_debris.len*sizeof(*g_debris.ring),
+                   0, GL_DYNAMIC_DRAW);
+    glBindBuffer_p(GL_ARRAY_BUFFER, 0);
+    g_debris.enabled = TRUE;
+}
+
+/* Discard all fragments. */
+static void
+g_debris_clear(void)
+{
+    g_debris.tail = g_debris.uploaded = g_debris.head;
+}
+
+/* Queue a new fragment for upload. Position and time are those of its
+ * spawn, and V is its pair of endpoints relative to the position. TIME
+ * must not precede that of the previous spawn.
+ */
+static void
+g_debris_spawn(const struct v2 *v, float x, float y, float dx, float dy,
+               float da, double time, uint32_t color)
+{
+    if (g_debris.head == g_debris.tail) {
+        g_debris.epoch = time;  // keep spawn times small and precise
+    }
+    int next = (g_debris.head + 1) % g_debris.len;
+    if (next == g_debris.tail) {
+        g_debris.dropped++;
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        g_debris.ring[g_debris.head][i].x  = x;
+        g_debris.ring[g_debris.head][i].y  = y;
+        g_debris.ring[g_debris.head][i].dx = dx;
+        g_debris.ring[g_debris.head][i].dy = dy;
+        g_debris.ring[g_debris.head][i].vx = v[i].x;
+        g_debris.ring[g_debris.head][i].vy = v[i].y;
+        g_debris.ring[g_debris.head][i].da = da;
+        g_debris.ring[g_debris.head][i].t0 = time - g_debris.epoch;
+        g_debris.ring[g_debris.head][i].r  = color >> 16;
+        g_debris.ring[g_debris.head][i].g  = color >>  8;
+        g_debris.ring[g_debris.head][i].b  = color >>  0;
+        g_debris.ring[g_debris.head][i].a  = 0xff;
+    }
+    g_debris.head = next;
+}
+
+/* Upload ring entries [beg, end), which do not wrap. */
+static void
+g_debris_upload(int beg, int end)
+{
+    ptrdiff_t size = sizeof(*g_debris.ring);
+    glBufferSubData_p(GL_ARRAY_BUFFER, beg*size, (end - beg)*size,
+                      g_debris.ring + beg);
+}
+
+/* Draw live ring entries [beg, end), which do not wrap. */
+static void
+g_debris_draw(int beg, int end)
+{
+    for (int i = 0; i < COUNTOF(toroid); i++) {
+        glUniform2f_p(g_debris.offset, toroid[i][0], toroid[i][1]);
+        glDrawArrays(GL_LINES, beg*2, (end - beg)*2);
+    }
+}
+
+/* Upload fragments spawned since the last frame, retire those past
+ * TTL, and draw the rest as of TIME.
+ */
+static void
+g_debris_render(double time, float ttl)
+{
+    float now = time - g_debris.epoch;
+    while (g_debris.tail != g_debris.head &&
+           now - g_debris.ring[g_debris.tail][0].t0 > ttl) {
+        g_debris.tail = (g_debris.tail + 1) % g_debris.len;
+    }
+    if (g_debris.tail == g_debris.head) {
+        g_debris.uploaded = g_debris.head;
+        return;
+    }
+
+    glBindBuffer_p(GL_ARRAY_BUFFER, g_debris.vbo);
+    int beg = g_debris.uploaded;
+    int end = g_debris.head;
+    if (beg > end) {
+        g_debris_upload(beg, g_debris.len);
+        beg = 0;
+    }
+    g_debris_upload(beg, end);
+    g_debris.uploaded = g_debris.head;
+
+    // Fixed-function arrays left on by glInterleavedArrays would alias
+    // the generic attributes
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    GLsizei stride = sizeof(g_debris.ring[0][0]);
+    glUseProgram_p(g_debris.program);
+    glUniform1f_p(g_debris.time, now);
+    glUniform1f_p(g_debris.ttl, ttl);
+    glEnableVertexAttribArray_p(G_MOTION);
+    glEnableVertexAttribArray_p(G_SHAPE);
+    glEnableVertexAttribArray_p(G_COLOR);
+    glVertexAttribPointer_p(G_MOTION, 4, GL_FLOAT, 0, stride, (void *)0);
+    glVertexAttribPointer_p(G_SHAPE, 4, GL_FLOAT, 0, stride, (void *)16);
+    glVertexAttribPointer_p(G_COLOR, 4, GL_UNSIGNED_BYTE, 1, stride,
+                            (void *)32);
+
+    if (g_debris.tail > g_debris.head) {
+        g_debris_draw(g_debris.tail, g_debris.len);
+        g_debris_draw(0, g_debris.head);
+    } else {
+        g_debris_draw(g_debris.tail, g_debris.head);
+    }
+
+    glDisableVertexAttribArray_p(G_MOTION);
+    glDisableVertexAttribArray_p(G_SHAPE);
+    glDisableVertexAttribArray_p(G_COLOR);
+    glUseProgram_p(0);
+    glBindBuffer_p(GL_ARRAY_BUFFER, 0);
+}
+
+struct {
+    double last;
+    double time;  // simulated seconds
+    uint64_t seed;
+    uint64_t tick;
+    long level;
+    float transition;
+    long long score;
+    int lives;
+
+    #define I_TURNL  (1<<0)
     #define I_TURNR  (1<<1)
     #define I_THRUST (1<<2)
     #define I_FIRE   (1<<3)
     int controls;
 
-    float  px,  py,  pa;
-    float pdx, pdy, pda;
+    coord px, py;
+    velocity pdx, pdy;
+    float pa, pda;
 
     struct asteroid {
-        float  x,  y,  a;
-        float dx, dy, da;
-        struct v2 v[16];
-        short n;
+        coord x, y;
+        float a;
+        velocity dx, dy;
+        float da;
+        float scale;
+        short shape;
         short kind;
+        uint32_t id;   // keys its STREAM_SPLIT
         float shot_r2; // shot hit radius^2
         float ship_r2; // ship hit radius^2
-    } asteroids[1024];
-    int nasteroids;
+    } *asteroids;
+    int nasteroids, maxasteroids;
+    uint32_t nextid;
+    unsigned char *claimed;  // per asteroid, by a shot this tick
 
     struct shot {
-        float  x,  y;
-        float dx, dy;
+        coord x, y;
+        velocity dx, dy;
         float ttl;
-    } shots[64];
-    int nshots;
+    } *shots;
+    int nshots, maxshots;
+    int *hits;               // per shot, asteroid index or -1
     float cooldown;
 
     struct debris {
@@ -307,10 +1331,139 @@ struct {
         float age;
         uint32_t color;
         struct v2 v[2];
-    } debris[1024];
-    int ndebris;
+    } *debris;
+    int ndebris, maxdebris;
 } game;
 
+/* Stress mode replaces gameplay with a scripted load of configurable
+ * size and reports where the time goes. Counts are capped so that the
+ * pools sized from them stay within int.
+ */
+#define STRESS_MAX          1000000
+#define STRESS_MAX_SECONDS  3600
+enum stage {
+    STAGE_SHIP, STAGE_SHOTS, STAGE_ASTEROIDS, STAGE_COLLIDE, STAGE_HITS,
+    STAGE_DEBRIS, STAGE_DEATH, STAGE_PUBLISH, STAGE_RENDER, STAGE_COUNT
+};
+static const char stage_names[][10] = {
+    "ship", "shots", "asteroids", "collide", "hits", "debris", "death",
+    "publish", "render"
+};
+
+static struct {
+    BOOL enabled;
+    int nasteroids;
+    int nshots;
+    int ndebris;
+    int seconds;
+    double mark;
+    double time[STAGE_COUNT];       // performance counter ticks
+    long long work[STAGE_COUNT];    // entities processed
+} stress = {
+    .nasteroids = 10000,
+    .nshots = 1000,
+    .ndebris = 10000,
+    .seconds = 10,
+};
+
+/* Charge the time since the previous mark to a stage. */
+static void
+stress_mark(enum stage s, long long work)
+{
+    if (!stress.enabled) return;
+    double now = counter_now();
+    stress.time[s] += now - stress.mark;
+    stress.work[s] += work;
+    stress.mark = now;
+}
+
+/* Optional asteroid-asteroid collisions. A sweep-and-prune broadphase
+ * cuts the world into horizontal bands at least one asteroid diameter
+ * tall, keeps the asteroids sorted by band and then by the start of
+ * their x-interval, and only tests pairs in the same or adjacent bands
+ * whose intervals overlap. At constant density a band holds about the
+ * square root of the asteroids, so this stays near linear. The order
+ * persists across ticks, and asteroids barely move in one, so an
+ * insertion sort restores it. Only new asteroids and those that changed
+ * band or crossed the seam at x = 0 are sorted from scratch and merged.
+ */
+struct sweep {
+    float lo, hi;       // x-interval, lo in [0, 1) and hi possibly past 1
+    float y, r;         // for a y-overlap test without the asteroid
+    int band;           // sort key ahead of lo
+    int index;          // asteroid, or -1 once destroyed
+};
+
+static struct {
+    BOOL enabled;
+    int n;
+    struct sweep *order, *spare, *moved;
+    int *pos;           // per asteroid, its entry in order, or -1
+    int nbands;         // 1, or a power of two no less than 4
+    int *bands;         // start of each band in order, plus the end
+    long long moves;    // insertion sort shifts, for benchmarks
+    long long contacts; // overlapping pairs, for benchmarks
+} collide;
+
+static void
+collide_alloc(int nasteroids)
+{
+    collide.order = win32_alloc(nasteroids * sizeof(*collide.order));
+    collide.spare = win32_alloc(nasteroids * sizeof(*collide.spare));
+    collide.moved = win32_alloc(nasteroids * sizeof(*collide.moved));
+    collide.pos = win32_alloc(nasteroids * sizeof(*collide.pos));
+    collide.bands = win32_alloc((nasteroids + 1) * sizeof(*collide.bands));
+    collide.nbands = 1;
+}
+
+/* Track the swap-remove of asteroid N in the sweep order. */
+static void
+collide_remove(int n)
+{
+    int last = game.nasteroids - 1;
+    if (collide.pos[n] >= 0) {
+        collide.order[collide.pos[n]].index = -1;
+    }
+    if (n != last) {
+        collide.pos[n] = collide.pos[last];
+        if (collide.pos[n] >= 0) {
+            collide.order[collide.pos[n]].index = n;
+        }
+    }
+    collide.pos[last] = -1;
+}
+
+/* Library of unit-radius asteroid outlines, shared by all asteroids of
+ * a size class, generated once by shapes_init().
+ */
+static struct {
+    int n;
+    float min, max;
+    struct v2 v[ASTEROID_SHAPES][16];
+} shapes[] = {
+    [A0] = {16, ASTEROID0_MIN, ASTEROID0_MAX},
+    [A1] = {12, ASTEROID1_MIN, ASTEROID1_MAX},
+    [A2] = { 8, ASTEROID2_MIN, ASTEROID2_MAX},
+};
+
+static void
+shapes_init(void)
+{
+    for (int k = 0; k < COUNTOF(shapes); k++) {
+        struct stream s = stream_key(0, STREAM_SHAPES, k);
+        int n = shapes[k].n;
+        float min = shapes[k].min / shapes[k].max;
+        for (int i = 0; i < n; i++) {
+            struct v2 u = cis(2*PI * (i - 1) / (float)n);
+            for (int j = 0; j < ASTEROID_SHAPES; j++) {
+                float r = stream_f(&s)*(1 - min) + min;
+                shapes[k].v[j][i].x = r * u.x;
+                shapes[k].v[j][i].y = r * u.y;
+            }
+        }
+    }
+}
+
 static struct {
     double deadline;
     int16_t pcm_fire[AUDIO_HZ/5];
@@ -318,68 +1471,99 @@ static struct {
 } audio;
 
 static int
-game_asteroid(enum asteroid_size kind)
+game_asteroid(enum asteroid_size kind, struct stream *r)
 {
-    if (game.nasteroids == COUNTOF(game.asteroids)) return -1;
+    if (game.nasteroids == game.maxasteroids) return -1;
 
     struct asteroid *a = game.asteroids + game.nasteroids;
-    float dx, dy;
+    float x, y, dx, dy;
     do {
-        a->x  = randu();
-        a->y  = randu();
-        dx = a->x - 0.5f;
-        dy = a->y - 0.5f;
+        x  = stream_f(r);
+        y  = stream_f(r);
+        dx = x - 0.5f;
+        dy = y - 0.5f;
     } while (dx*dx + dy*dy < 0.1f);
-    a->dx = 0.1f * (2*randu() - 1);
-    a->dy = 0.1f * (2*randu() - 1);
-    a->a  = 2 * PI * randu();
-    a->da = PI*(2*randu() - 1);
-
-    int n = 0;
-    float min = 0;
-    float max = 0;
-    switch (kind) {
-    case A0: n = 16; max = ASTEROID0_MAX; min = ASTEROID0_MIN; break;
-    case A1: n = 12; max = ASTEROID1_MAX; min = ASTEROID1_MIN; break;
-    case A2: n =  8; max = ASTEROID2_MAX; min = ASTEROID2_MIN; break;
-    }
-    for (int i = 0; i < n; i++) {
-        float t = 2*PI * (i - 1) / (float)n;
-        float r = randu()*(max - min) + min;
-        a->v[i].x = r * cosf(t);
-        a->v[i].y = r * sinf(t);
-    }
-    a->n = n;
+    a->x  = coord_of(x);
+    a->y  = coord_of(y);
+    a->dx = velocity_of(0.1f * (2*stream_f(r) - 1));
+    a->dy = velocity_of(0.1f * (2*stream_f(r) - 1));
+    a->a  = 2 * PI * stream_f(r);
+    a->da = PI*(2*stream_f(r) - 1);
+
+    float min = shapes[kind].min;
+    float max = shapes[kind].max;
+    a->scale = max;
+    a->shape = stream_u32(r) % ASTEROID_SHAPES;
     a->kind = kind;
+    a->id = game.nextid++;
 
     // Make hit radius favor player since it's imprecise
     a->shot_r2 = max*max;
     a->ship_r2 = (max+min)*(max+min)/4;
 
+    if (collide.enabled) {
+        collide.pos[game.nasteroids] = -1;
+    }
     return game.nasteroids++;
 }
 
 static void
 game_new_level(void)
 {
-    game.px = game.py = 0.5f;
-    game.pdx = game.pdy = 0.0f;
+    game.px = game.py = coord_of(0.5f);
+    game.pdx = game.pdy = velocity_of(0.0f);
 
     game.nshots = 0;
     game.ndebris = 0;
+    g_debris_clear();
     game.cooldown = 0;
     game.transition = 0;
     game.lives = 1;
 
     game.nasteroids = 0;
-    for (int i = 0; i < game.level; i++) {
-        game_asteroid(A0);
+    collide.n = 0;
+    long count = stress.enabled ? stress.nasteroids : game.level;
+    for (long i = 0; i < count; i++) {
+        uint64_t index = (uint64_t)game.level<<32 | i;
+        struct stream r = stream_key(game.seed, STREAM_LEVEL, index);
+        game_asteroid(A0, &r);
     }
 }
 
 static void
-game_init(int size)
+game_alloc(void)
 {
+    int nasteroids = MAX_ASTEROIDS;
+    int nshots = MAX_SHOTS;
+    int ndebris = MAX_DEBRIS;
+    if (stress.enabled) {
+        // Leave room for splits and their debris
+        nasteroids += 2*stress.nasteroids;
+        nshots += stress.nshots;
+        ndebris += 2*stress.ndebris + 16*stress.nshots;
+    }
+    game.asteroids = win32_alloc(nasteroids * sizeof(*game.asteroids));
+    game.claimed = win32_alloc(nasteroids * sizeof(*game.claimed));
+    game.maxasteroids = nasteroids;
+    game.shots = win32_alloc(nshots * sizeof(*game.shots));
+    game.hits = win32_alloc(nshots * sizeof(*game.hits));
+    game.maxshots = nshots;
+    game.debris = win32_alloc(ndebris * sizeof(*game.debris));
+    game.maxdebris = ndebris;
+    if (collide.enabled) {
+        collide_alloc(nasteroids);
+    }
+}
+
+/* Prepare rendering for a SIZE-pixel square frame. */
+static void
+g_init(int size)
+{
+    g_pixel = 1.0f / size;
+    g_linewidth = 2e-3f * size;
+    g_pointsize = 4e-3f * size;
+    if (g_headless) return;
+
     glEnable(GL_LINE_SMOOTH);
     glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
     glEnable(GL_POINT_SMOOTH);
@@ -389,19 +1573,40 @@ game_init(int size)
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glLineWidth(2e-3f * size);
-    glPointSize(4e-3f * size);
+    glLineWidth(g_linewidth);
+    glPointSize(g_pointsize);
 
-    rng += uepoch() * 1e6;
+    if (!g_nogpu) {
+        g_debris_init(game.maxdebris);
+    }
+}
 
+/* Begin a new game from the seed. */
+static void
+game_start(void)
+{
     game.level = INIT_COUNT;
-    game.last = uepoch();
+    game.last = counter_now() / counter_freq();
+    game.time = 0;
+    game.tick = 0;
+    game.nextid = 0;
+    rng = stream_key(game.seed, STREAM_TICK, 0);
     game.pa = PI/2;
     game.pda = 0.0f;
     game.controls = 0;
     game.score = 0;
 
     game_new_level();
+}
+
+static void
+game_init(void)
+{
+    shapes_init();
+    game.seed = uepoch() * 1e6;
+
+    game_alloc();
+    game_start();
 
     /* Synthesize sound effects */
 
@@ -409,7 +1614,7 @@ game_init(int size)
         float t = (float)i / AUDIO_HZ;
         float f = 440 - t*300;
         float v = (float)i/COUNTOF(audio.pcm_fire);
-        audio.pcm_fire[i] = 0x7fff * sinf(2*PI*t*f)*(1 - v*v);
+        audio.pcm_fire[i] = 0x7fff * cis(2*PI*t*f).y*(1 - v*v);
     }
 
     for (int i = 0; i < COUNTOF(audio.pcm_destroy); i++) {
@@ -446,46 +1651,148 @@ game_up(int control)
     }
 }
 
+/* Control changes gathered by the input thread, each stamped with the
+ * simulation clock so that game_step can apply it at its exact time
+ * within the tick. Single producer, single consumer, no locks.
+ */
+#define INPUT_QUEUE 256
+static struct {
+    struct input_event {
+        double time;
+        int control;
+        BOOL down;
+    } queue[INPUT_QUEUE];
+    volatile unsigned head;  // written only by the input thread
+    volatile unsigned tail;  // written only by game_step
+    HWND window;
+    BOOL raw;                // keyboard arrives through the input thread
+    HANDLE ready;            // signaled once raw is settled
+    BOOL show;               // report latency in the window title
+    int keys;                // keyboard controls held, input thread only
+    double latency_sum;
+    double latency_max;
+    long latency_count;
+} input;
+
+/* Session recording runs live play on fixed ticks, exactly as replay
+ * will, applying queued input only at tick boundaries and logging the
+ * controls held through each tick.
+ */
+#define RECORD_MAX   (4L*60*60*FRAMERATE)  // ticks, four hours
+#define RECORD_BURST 4                      // most ticks caught up per frame
+#define SESSION_MAX  (RECORD_MAX + RECORD_MAX/32 + 256)  // bytes, CRLF ok
+static struct {
+    char *path;
+    BOOL enabled;
+    BOOL saved;              // written early when the log filled up
+    unsigned char *ticks;    // controls per tick
+    long len;
+    int release;             // taps to release at the next tick
+    double base;             // wall clock at tick 0
+} record;
+
+static void
+input_push(int control, BOOL down)
+{
+    unsigned head = input.head;
+    if (!control || head - input.tail == INPUT_QUEUE) {
+        return;  // full: drop rather than block the producer
+    }
+    struct input_event *e = input.queue + head%INPUT_QUEUE;
+    e->time = counter_now() / counter_freq();
+    e->control = control;
+    e->down = down;
+    MemoryBarrier();  // publish the event before the index
+    input.head = head + 1;
+}
+
+/* Pop the next event stamped no later than NOW. */
+static BOOL
+input_pop(struct input_event *e, double now)
+{
+    unsigned tail = input.tail;
+    if (tail == input.head) {
+        return FALSE;
+    }
+    MemoryBarrier();  // read the index before the event
+    *e = input.queue[tail%INPUT_QUEUE];
+    if (e->time > now) {
+        return FALSE;
+    }
+    MemoryBarrier();  // finish reading before releasing the slot
+    input.tail = tail + 1;
+
+    double latency = now - e->time;
+    input.latency_sum += latency;
+    input.latency_count++;
+    if (latency > input.latency_max) {
+        input.latency_max = latency;
+    }
+    return TRUE;
+}
+
+/* Spawn a fragment spinning at DA, already AGE seconds old. Ages must
+ * not exceed those of fragments spawned earlier in the tick, for the GPU
+ * ring's sake.
+ */
 static void
-game_debris(struct v2 *v, float x, float y, float dx, float dy, uint32_t c)
+game_debris(struct v2 *v, float x, float y, float dx, float dy, float da,
+            float age, uint32_t c)
 {
-    if (game.ndebris < COUNTOF(game.debris)) {
+    if (game.ndebris < game.maxdebris) {
         int i = game.ndebris++;
         game.debris[i].x     = x;
         game.debris[i].y     = y;
         game.debris[i].dx    = dx;
         game.debris[i].dy    = dy;
-        game.debris[i].da    = 2*PI*(2*randu() - 1);
-        game.debris[i].age   = 0;
+        game.debris[i].da    = da;
+        game.debris[i].age   = age;
         game.debris[i].color = c & 0xffffff;
         game.debris[i].v[0]  = v[0];
         game.debris[i].v[1]  = v[1];
+        if (g_debris.enabled) {
+            g_debris_spawn(v, x, y, dx, dy, game.debris[i].da,
+                           game.time - (double)age, c);
+        }
     }
 }
 
+/* Break up asteroid N. Its fragments and children draw from a stream
+ * keyed by the asteroid, not the tick, so they don't depend on what
+ * else is destroyed in the same tick or in what order.
+ */
 static void
 game_destroy_asteroid(int n)
 {
     struct asteroid *a = game.asteroids + n;
-    struct tf t = tf(a->a, 0, 0);
-    for (int i = 0; i < a->n; i++) {
-        int j = (i + 1)%a->n;
+    struct stream r = stream_key(game.seed, STREAM_SPLIT, a->id);
+    struct tf t = tf_scale(tf(a->a, 0, 0), a->scale);
+    int nv = shapes[a->kind].n;
+    const struct v2 *sv = shapes[a->kind].v[a->shape];
+    for (int i = 0; i < nv; i++) {
+        int j = (i + 1)%nv;
         struct v2 v[] = {
-            tf_apply(t, a->v[i]),
-            tf_apply(t, a->v[j]),
+            tf_apply(t, sv[i]),
+            tf_apply(t, sv[j]),
         };
         float mx = (v[0].x + v[1].x) / 2;
         float my = (v[0].y + v[1].y) / 2;
         v[0].x -= mx; v[1].x -= mx;
         v[0].y -= my; v[1].y -= my;
-        float dx = a->dx + mx*randu();
-        float dy = a->dy + my*randu();
-        game_debris(v, a->x+mx, a->y+my, dx, dy, C_ASTEROID);
+        float dx = velocity_f(a->dx) + mx*stream_f(&r);
+        float dy = velocity_f(a->dy) + my*stream_f(&r);
+        float da = 2*PI*(2*stream_f(&r) - 1);
+        float x = coord_f(a->x) + mx;
+        float y = coord_f(a->y) + my;
+        game_debris(v, x, y, dx, dy, da, 0, C_ASTEROID);
     }
 
-    float x = a->x;
-    float y = a->y;
+    coord x = a->x;
+    coord y = a->y;
     enum asteroid_size kind = a->kind;
+    if (collide.enabled) {
+        collide_remove(n);
+    }
     game.asteroids[n] = game.asteroids[--game.nasteroids];
 
     switch (kind) {
@@ -495,9 +1802,9 @@ game_destroy_asteroid(int n)
     }
 
     if (kind != A2) {
-        int c = 1 + rand32()%2;
+        int c = 1 + stream_u32(&r)%2;
         for (int i = 0; i < c; i++) {
-            int n = game_asteroid(kind + 1);
+            int n = game_asteroid(kind + 1, &r);
             if (n >= 0) {
                 game.asteroids[n].x = x;
                 game.asteroids[n].y = y;
@@ -521,177 +1828,592 @@ game_sound(double now, enum sound what)
     case SOUND_FIRE:
         len = COUNTOF(audio.pcm_fire);
         win32_audio_mix(audio.pcm_fire, len);
+        capture_sound(audio.pcm_fire, len);
         break;
     case SOUND_DESTROY:
         len = COUNTOF(audio.pcm_destroy);
         win32_audio_mix(audio.pcm_destroy, len);
+        capture_sound(audio.pcm_destroy, len);
         break;
     }
     if (len) audio.deadline = now + len/(double)AUDIO_HZ - 0.015;
 }
 
+/* Find the first asteroid hit by each shot in [FIRST, LAST), writing
+ * its index, or -1, to the shot's slot in game.hits. Nothing else is
+ * written, so shot ranges may be split among threads in any way with
+ * identical results.
+ */
 static void
-game_step(void)
+game_detect(int first, int last)
 {
-    double now = uepoch();
-    float dt = now - game.last;
-    if (dt > TIME_STEP_MIN) dt = TIME_STEP_MIN;
-    game.last = now;
-
-    if (!game.lives || !game.nasteroids) {
-        game.transition += dt;
-    }
-
-    if (!game.lives && game.transition > LEVEL_DELAY) {
-        game.score /= 2;
-        game_new_level();
-    } else if (!game.nasteroids && game.transition > LEVEL_DELAY) {
-        game.score += game.level * 100;
-        game.level++;
-        game_new_level();
-    }
-
-    game.pa   = fmodf(game.pa + dt*game.pda + 2*PI, 2*PI);
-    if (game.controls & I_THRUST) {
-        float c = cosf(game.pa);
-        float s = sinf(game.pa);
-        game.pdx += dt*c*SHIP_ACCEL;
-        game.pdy += dt*s*SHIP_ACCEL;
-
-        /* thruster fire trail */
-        if (randu() < 0.75f) {
-            float f = SHIP_SCALE*0.15f;
-            struct v2 v[] = {
-                {(2*randu() - 1)*f, (2*randu() - 1)*f},
-                {(2*randu() - 1)*f, (2*randu() - 1)*f},
-            };
-            float x = game.px + c*ship[3].x;
-            float y = game.py + s*ship[3].x;
-            game_debris(v, x, y, -c*0.1f, -s*0.1f, C_FIRE);
-        }
-    }
-    game.px   = fmodf(game.px + dt*game.pdx + 1, 1);
-    game.py   = fmodf(game.py + dt*game.pdy + 1, 1);
-    game.pdx *= SHIP_DAMPEN;
-    game.pdy *= SHIP_DAMPEN;
-
-    if ((game.controls & I_FIRE) &&
-        game.nshots < COUNTOF(game.shots) &&
-        game.cooldown <= 0) {
-
-        int i = game.nshots++;
-        float c = cosf(game.pa);
-        float s = sinf(game.pa);
-        game.shots[i].x = SHIP_SCALE*c+game.px;
-        game.shots[i].y = SHIP_SCALE*s+game.py;
-        game.shots[i].dx = game.pdx + c*SHOT_SPEED;
-        game.shots[i].dy = game.pdy + s*SHOT_SPEED;
-        game.shots[i].ttl = SHOT_TTL;
-        game.cooldown = SHOT_COOLDOWN;
-        game_sound(now, SOUND_FIRE);
-    } else if (game.cooldown > 0) {
-        game.cooldown -= dt;
-    }
-
-    for (int i = 0; i < game.nshots; i++) {
-        struct shot *s = game.shots + i;
-        if ((s->ttl -= dt) < 0) {
-            // TODO: hit detection for final partial step
-            game.shots[i--] = game.shots[--game.nshots];
-        } else {
-            s->x = fmodf(s->x + dt*s->dx + 1, 1);
-            s->y = fmodf(s->y + dt*s->dy + 1, 1);
-        }
-    }
-
-    for (int i = 0; i < game.nasteroids; i++) {
-        struct asteroid *a = game.asteroids + i;
-        a->x = fmodf(a->x + dt*a->dx + 1, 1);
-        a->y = fmodf(a->y + dt*a->dy + 1, 1);
-        a->a = fmodf(a->a + dt*a->da, 360);
-    }
-
     // TODO: precise hit detection
-    for (int i = 0; i < game.nshots; i++) {
+    for (int i = first; i < last; i++) {
         struct shot *s = game.shots + i;
+        game.hits[i] = -1;
         for (int j = 0; j < game.nasteroids; j++) {
             struct asteroid *a = game.asteroids + j;
-            float dx = s->x - a->x;
-            float dy = s->y - a->y;
+            float dx = coord_delta(s->x, a->x);
+            float dy = coord_delta(s->y, a->y);
             if (dx*dx + dy*dy < a->shot_r2) {
-                game.shots[i--] = game.shots[--game.nshots];
-                game_destroy_asteroid(j--);
-                game_sound(now, SOUND_DESTROY);
+                game.hits[i] = j;
                 break;
             }
         }
     }
+}
 
-    for (int i = 0; i < game.ndebris; i++) {
-        if ((game.debris[i].age += dt) > DEBRIS_TTL) {
-            game.debris[i--] = game.debris[--game.ndebris];
-        }
-    }
+/* Fold a difference of torus positions into [-0.5, 0.5]. */
+static float
+torus_delta(float d)
+{
+    return d - ((d > 0.5f) - (d < -0.5f));
+}
 
-    // TODO: precise hit detection
-    struct tf t = tf(game.pa, game.px, game.py);
-    for (int i = 0; game.lives && i < COUNTOF(ship); i++) {
-        struct v2 p = tf_apply(t, ship[i]);
-        for (int j = 0; j < game.nasteroids; j++) {
-            struct asteroid *a = game.asteroids + j;
-            float dx = p.x - a->x;
-            float dy = p.y - a->y;
-            if (dx*dx + dy*dy < a->ship_r2) {
-                game.lives = 0;
-                for (int i = 0; i < 256; i++) {
-                    float s = 0.01f;
-                    struct v2 v[] = {
-                        {s*(randu()*2 - 1), s*(randu()*2 - 1)},
-                        {s*(randu()*2 - 1), s*(randu()*2 - 1)},
-                    };
-                    float r = 0.25f*randu();
-                    float a = 2*PI*randu();
-                    float dx = game.pdx/2 + r*cosf(a);
-                    float dy = game.pdy/2 + r*sinf(a);
-                    uint32_t color = randu() < 0.7f ? C_SHIP : C_FIRE;
-                    game_debris(v, game.px, game.py, dx, dy, color);
-                }
-                game_sound(now, SOUND_DESTROY);
-                break;
-            }
-        }
-    }
+/* Sweep entry for asteroid I. Fixed-point coordinates just under 1 round
+ * up to 1.0f as floats, so both axes are wrapped again.
+ */
+static struct sweep
+sweep_entry(int i)
+{
+    struct asteroid *a = game.asteroids + i;
+    float y = wrap(coord_f(a->y));
+    float lo = wrap(coord_f(a->x) - a->scale);
+    return (struct sweep){
+        lo, lo + 2*a->scale, y, a->scale, (int)(y*collide.nbands), i
+    };
+}
 
-    game_sound(now, SOUND_SILENCE);
+/* Does A sort before B? */
+static int
+sweep_less(const struct sweep *a, const struct sweep *b)
+{
+    return a->band < b->band || (a->band == b->band && a->lo < b->lo);
 }
 
+/* Insertion sort by band and interval start, linear when nearly sorted. */
 static void
-game_render(void)
+sweep_isort(struct sweep *s, int n)
 {
-    for (int i = 0; i < game.nasteroids; i++) {
-        struct asteroid *a = game.asteroids + i;
-        g_wlineloop(a->v, a->n, tf(a->a, a->x, a->y), C_ASTEROID);
+    for (int i = 1; i < n; i++) {
+        struct sweep t = s[i];
+        int j = i;
+        for (; j > 0 && sweep_less(&t, s + j - 1); j--) {
+            s[j] = s[j-1];
+        }
+        s[j] = t;
+        collide.moves += i - j;
     }
+}
 
-    for (int i = 0; i < game.nshots; i++) {
-        g_wpoint(game.shots[i].x, game.shots[i].y, C_SHOT);
+/* Merge sorted runs A and B into DST. */
+static void
+sweep_merge(struct sweep *dst, const struct sweep *a, int na,
+            const struct sweep *b, int nb)
+{
+    int i = 0, j = 0;
+    while (i < na && j < nb) {
+        *dst++ = sweep_less(b + j, a + i) ? b[j++] : a[i++];
     }
+    while (i < na) *dst++ = a[i++];
+    while (j < nb) *dst++ = b[j++];
+}
 
-    if (game.lives) {
-        struct tf ship_tf = tf(game.pa, game.px, game.py);
-        g_wlineloop(ship, COUNTOF(ship), ship_tf, C_SHIP);
-        if ((game.controls & I_THRUST) && randu() < 0.5f) {
-            g_wlinestrip(tail, COUNTOF(tail), ship_tf, C_THRUST);
+/* Bottom-up merge sort of N entries, using TMP as scratch. */
+static void
+sweep_sort(struct sweep *s, struct sweep *tmp, int n)
+{
+    for (int w = 1; w < n; w *= 2) {
+        for (int i = 0; i < n; i += 2*w) {
+            int m = i + w < n ? i + w : n;
+            int e = i + 2*w < n ? i + 2*w : n;
+            sweep_merge(tmp + i, s + i, m - i, s + m, e - m);
         }
-    } else {
+        memcpy(s, tmp, n * sizeof(*s));
+    }
+}
+
+/* Bring the sweep order up to date with this tick's positions. */
+static void
+collide_update(void)
+{
+    // Bands at least as tall as the largest pair of radii, so that only
+    // adjacent bands can touch, and at least three so that the bands on
+    // either side are distinct
+    float rmax = 0;
+    for (int i = 0; i < game.nasteroids; i++) {
+        float r = game.asteroids[i].scale;
+        rmax = r > rmax ? r : rmax;
+    }
+    int nbands = 1;
+    while (nbands*2 <= game.nasteroids && nbands*4*rmax <= 1) {
+        nbands *= 2;
+    }
+    collide.nbands = nbands < 4 ? 1 : nbands;
+
+    int kept = 0, moved = 0;
+    for (int i = 0; i < collide.n; i++) {
+        int j = collide.order[i].index;
+        if (j < 0) continue;
+        struct sweep e = sweep_entry(j);
+        float d = e.lo - collide.order[i].lo;
+        if (e.band != collide.order[i].band || d > 0.5f || d < -0.5f) {
+            collide.moved[moved++] = e;
+        } else {
+            collide.order[kept++] = e;
+        }
+    }
+    for (int i = 0; i < game.nasteroids; i++) {
+        if (collide.pos[i] < 0) {
+            collide.moved[moved++] = sweep_entry(i);
+        }
+    }
+
+    sweep_isort(collide.order, kept);
+    sweep_sort(collide.moved, collide.spare, moved);
+    sweep_merge(collide.spare, collide.order, kept, collide.moved, moved);
+    struct sweep *swap = collide.order;
+    collide.order = collide.spare;
+    collide.spare = swap;
+    collide.n = kept + moved;
+    for (int i = 0, k = 0; i <= collide.n; i++) {
+        int band = i < collide.n ? collide.order[i].band : collide.nbands;
+        for (; k <= band; k++) {
+            collide.bands[k] = i;
+        }
+        if (i < collide.n) {
+            collide.pos[collide.order[i].index] = i;
+        }
+    }
+}
+
+/* Bounce asteroids I and J apart elastically, with mass by area, if
+ * they overlap and are approaching.
+ */
+static void
+collide_pair(int i, int j)
+{
+    struct asteroid *a = game.asteroids + i;
+    struct asteroid *b = game.asteroids + j;
+    float dx = torus_delta(coord_delta(b->x, a->x));
+    float dy = torus_delta(coord_delta(b->y, a->y));
+    float r = a->scale + b->scale;
+    float d2 = dx*dx + dy*dy;
+    if (d2 >= r*r || d2 == 0) return;
+    collide.contacts++;
+
+    float vx = velocity_f(b->dx) - velocity_f(a->dx);
+    float vy = velocity_f(b->dy) - velocity_f(a->dy);
+    float vn = vx*dx + vy*dy;
+    if (vn >= 0) return;
+
+    float ma = a->scale * a->scale;
+    float mb = b->scale * b->scale;
+    float f = 2*vn / (d2 * (ma + mb));
+    a->dx += velocity_of(f*mb*dx);
+    a->dy += velocity_of(f*mb*dy);
+    b->dx -= velocity_of(f*ma*dx);
+    b->dy -= velocity_of(f*ma*dy);
+}
+
+/* Collide P with the entries of band S, from Q onward, whose intervals
+ * start inside its own, returning the number of pairs tested. An
+ * interval that runs past the seam also overlaps the first intervals in
+ * the band.
+ */
+static long long
+sweep_scan(const struct sweep *p, const struct sweep *s, int n, int q)
+{
+    long long tests = 0;
+    float hi = p->hi;
+    for (int wrap = 0; n && (q < n || (!wrap && hi > 1)); q++) {
+        if (q == n) {
+            // Continue from the front for an interval past the seam
+            q = 0;
+            hi -= 1;
+            wrap = 1;
+        }
+        if (s + q == p || s[q].lo >= hi) break;
+        tests++;
+        float dy = torus_delta(s[q].y - p->y);
+        float r = p->r + s[q].r;
+        if (dy*dy < r*r) {
+            collide_pair(p->index, s[q].index);
+        }
+    }
+    return tests;
+}
+
+/* Collide every overlapping pair of asteroids, returning the number of
+ * pairs tested. Each pair is found from the entry whose interval starts
+ * first, and across bands an exact tie goes to the lower band. No pair
+ * can be found both ways while every two radii sum to under half the
+ * world.
+ */
+static long long
+game_collide(void)
+{
+    collide_update();
+    long long tests = 0;
+    int nb = collide.nbands;
+    const struct sweep *s = collide.order;
+    for (int k = 0; k < nb; k++) {
+        int up = (k + 1) % nb;
+        int down = (k + nb - 1) % nb;
+        const struct sweep *a = s + collide.bands[k];
+        const struct sweep *u = s + collide.bands[up];
+        const struct sweep *d = s + collide.bands[down];
+        int na = collide.bands[k+1] - collide.bands[k];
+        int nu = collide.bands[up+1] - collide.bands[up];
+        int nd = collide.bands[down+1] - collide.bands[down];
+        for (int i = 0, iu = 0, id = 0; i < na; i++) {
+            tests += sweep_scan(a + i, a, na, i + 1);
+            if (nb > 1) {
+                while (iu < nu && u[iu].lo < a[i].lo) iu++;
+                while (id < nd && d[id].lo <= a[i].lo) id++;
+                tests += sweep_scan(a + i, u, nu, iu);
+                tests += sweep_scan(a + i, d, nd, id);
+            }
+        }
+    }
+    return tests;
+}
+
+/* Advance the ship by DT under the current controls. Only the final
+ * piece of a tick lays down thruster trail.
+ */
+static void
+game_ship(float dt, BOOL trail)
+{
+    game.pa   = wrap_angle(game.pa + dt*game.pda);
+    if (game.controls & I_THRUST) {
+        struct v2 u = cis(game.pa);
+        float c = u.x;
+        float s = u.y;
+        game.pdx += velocity_of(dt*c*SHIP_ACCEL);
+        game.pdy += velocity_of(dt*s*SHIP_ACCEL);
+
+        /* thruster fire trail */
+        if (trail && randu() < 0.75f) {
+            float f = SHIP_SCALE*0.15f;
+            struct v2 v[] = {
+                {(2*randu() - 1)*f, (2*randu() - 1)*f},
+                {(2*randu() - 1)*f, (2*randu() - 1)*f},
+            };
+            float x = coord_f(game.px) + c*ship[3].x;
+            float y = coord_f(game.py) + s*ship[3].x;
+            float da = 2*PI*(2*randu() - 1);
+            game_debris(v, x, y, -c*0.1f, -s*0.1f, da, 0, C_FIRE);
+        }
+    }
+    game.px   = coord_move(game.px, game.pdx, dt);
+    game.py   = coord_move(game.py, game.pdy, dt);
+}
+
+static void
+game_step(double now)
+{
+    float dt = now - game.last;
+    if (dt > TIME_STEP_MIN) dt = TIME_STEP_MIN;
+    game.last = now;
+    game.time += (double)dt;
+    rng = stream_key(game.seed, STREAM_TICK, ++game.tick);
+
+    if (!game.lives || !game.nasteroids) {
+        game.transition += dt;
+    }
+
+    if (!game.lives && game.transition > LEVEL_DELAY) {
+        game.score /= 2;
+        game_new_level();
+    } else if (!game.nasteroids && game.transition > LEVEL_DELAY) {
+        game.score += game.level * 100;
+        game.level++;
+        game_new_level();
+    }
+
+    /* Integrate the ship piecewise, applying each queued control change
+     * at its own offset into the tick. A recording applies them at tick
+     * boundaries instead, so that replay reproduces it.
+     */
+    int held = game.controls;
+    float done = 0;
+    for (struct input_event e; !record.enabled && input_pop(&e, now);) {
+        float at = dt - (float)(now - e.time);
+        at = at < done ? done : at;
+        game_ship(at - done, FALSE);
+        done = at;
+        if (e.down) {
+            game_down(e.control);
+        } else {
+            game_up(e.control);
+        }
+        held |= game.controls;
+    }
+    game_ship(dt - done, TRUE);
+    game.pdx = velocity_scale(game.pdx, SHIP_DAMPEN);
+    game.pdy = velocity_scale(game.pdy, SHIP_DAMPEN);
+
+    if ((held & I_FIRE) &&
+        game.nshots < game.maxshots &&
+        game.cooldown <= 0) {
+
+        int i = game.nshots++;
+        struct v2 u = cis(game.pa);
+        float c = u.x;
+        float s = u.y;
+        game.shots[i].x = coord_add(game.px, SHIP_SCALE*c);
+        game.shots[i].y = coord_add(game.py, SHIP_SCALE*s);
+        game.shots[i].dx = game.pdx + velocity_of(c*SHOT_SPEED);
+        game.shots[i].dy = game.pdy + velocity_of(s*SHOT_SPEED);
+        game.shots[i].ttl = SHOT_TTL;
+        game.cooldown = SHOT_COOLDOWN;
+        game_sound(now, SOUND_FIRE);
+    } else if (game.cooldown > 0) {
+        game.cooldown -= dt;
+    }
+    stress_mark(STAGE_SHIP, 1);
+
+    for (int i = 0; i < game.nshots; i++) {
+        struct shot *s = game.shots + i;
+        if ((s->ttl -= dt) < 0) {
+            // TODO: hit detection for final partial step
+            game.shots[i--] = game.shots[--game.nshots];
+        } else {
+            s->x = coord_move(s->x, s->dx, dt);
+            s->y = coord_move(s->y, s->dy, dt);
+        }
+    }
+    stress_mark(STAGE_SHOTS, game.nshots);
+
+    for (int i = 0; i < game.nasteroids; i++) {
+        struct asteroid *a = game.asteroids + i;
+        a->x = coord_move(a->x, a->dx, dt);
+        a->y = coord_move(a->y, a->dy, dt);
+        a->a = wrap_angle(a->a + dt*a->da);
+    }
+    stress_mark(STAGE_ASTEROIDS, game.nasteroids);
+
+    if (collide.enabled) {
+        stress_mark(STAGE_COLLIDE, game_collide());
+    }
+
+    long long pairs = (long long)game.nshots * game.nasteroids;
+    game_detect(0, game.nshots);
+
+    /* The first shot to claim an asteroid destroys it, and any later
+     * shot at the same asteroid flies on. Removal runs from the highest
+     * index down so that swap-removes never disturb pending entries.
+     */
+    for (int i = 0; i < game.nshots; i++) {
+        int j = game.hits[i];
+        if (j >= 0 && game.claimed[j]) {
+            game.hits[i] = -1;
+        } else if (j >= 0) {
+            game.claimed[j] = 1;
+        }
+    }
+    for (int i = game.nshots - 1; i >= 0; i--) {
+        if (game.hits[i] >= 0) {
+            game.shots[i] = game.shots[--game.nshots];
+        }
+    }
+    int destroyed = 0;
+    for (int j = game.nasteroids - 1; j >= 0; j--) {
+        if (game.claimed[j]) {
+            game.claimed[j] = 0;
+            game_destroy_asteroid(j);
+            destroyed++;
+        }
+    }
+    if (destroyed) {
+        game_sound(now, SOUND_DESTROY);
     }
+    stress_mark(STAGE_HITS, pairs);
 
+    long long ndebris = game.ndebris;
     for (int i = 0; i < game.ndebris; i++) {
-        struct debris *d = game.debris + i;
-        float dt = d->age;
-        struct tf t = tf(dt*d->da, d->x + dt*d->dx, d->y + dt*d->dy);
-        uint32_t alpha = 255 * (1 - d->age/DEBRIS_TTL);
-        g_wlinestrip(d->v, COUNTOF(d->v), t, d->color | alpha<<24);
+        if ((game.debris[i].age += dt) > DEBRIS_TTL) {
+            game.debris[i--] = game.debris[--game.ndebris];
+        }
+    }
+    stress_mark(STAGE_DEBRIS, ndebris);
+
+    // TODO: precise hit detection
+    struct tf t = tf(game.pa, coord_f(game.px), coord_f(game.py));
+    for (int i = 0; game.lives && i < COUNTOF(ship); i++) {
+        struct v2 p = tf_apply(t, ship[i]);
+        coord px = coord_of(p.x);
+        coord py = coord_of(p.y);
+        for (int j = 0; j < game.nasteroids; j++) {
+            struct asteroid *a = game.asteroids + j;
+            float dx = coord_delta(px, a->x);
+            float dy = coord_delta(py, a->y);
+            if (dx*dx + dy*dy < a->ship_r2) {
+                game.lives = 0;
+
+                // Draw everything for the explosion in one batch
+                enum {ANGLE, V0X, V0Y, V1X, V1Y, SPEED, SPIN, COLOR, NRAND};
+                float r[NRAND][256], c[256], s[256];
+                struct stream rs = stream_key(game.seed, STREAM_DEATH,
+                                              game.tick);
+                stream_fill(&rs, r[0], NRAND*COUNTOF(r[0]));
+                for (int i = 0; i < COUNTOF(r[0]); i++) {
+                    r[ANGLE][i] *= 2*PI;
+                }
+                cisv(c, s, r[ANGLE], COUNTOF(r[0]));
+                for (int i = 0; i < COUNTOF(r[0]); i++) {
+                    float f = 0.01f;
+                    struct v2 v[] = {
+                        {f*(r[V0X][i]*2 - 1), f*(r[V0Y][i]*2 - 1)},
+                        {f*(r[V1X][i]*2 - 1), f*(r[V1Y][i]*2 - 1)},
+                    };
+                    float speed = 0.25f*r[SPEED][i];
+                    float dx = velocity_f(game.pdx)/2 + speed*c[i];
+                    float dy = velocity_f(game.pdy)/2 + speed*s[i];
+                    float x = coord_f(game.px);
+                    float y = coord_f(game.py);
+                    float da = 2*PI*(2*r[SPIN][i] - 1);
+                    uint32_t color = r[COLOR][i] < 0.7f ? C_SHIP : C_FIRE;
+                    game_debris(v, x, y, dx, dy, da, 0, color);
+                }
+                game_sound(now, SOUND_DESTROY);
+                break;
+            }
+        }
+    }
+
+    stress_mark(STAGE_DEATH, game.lives ? COUNTOF(ship)*game.nasteroids : 0);
+
+    game_sound(now, SOUND_SILENCE);
+}
+
+/* Hash the complete simulation state. */
+static uint64_t
+game_hash(void)
+{
+    #define HASH(v) h = hash64(h, &(v), sizeof(v))
+    uint64_t h = HASH_INIT;
+    HASH(game.time);
+    HASH(game.tick);
+    HASH(game.level);
+    HASH(game.transition);
+    HASH(game.score);
+    HASH(game.lives);
+    HASH(game.controls);
+    HASH(game.px);  HASH(game.py);  HASH(game.pa);
+    HASH(game.pdx); HASH(game.pdy); HASH(game.pda);
+    HASH(game.cooldown);
+    HASH(rng);
+    h = hashv(h, game.asteroids, game.nasteroids*sizeof(*game.asteroids));
+    h = hashv(h, game.shots, game.nshots*sizeof(*game.shots));
+    h = hashv(h, game.debris, game.ndebris*sizeof(*game.debris));
+    #undef HASH
+    return h;
+}
+
+static void
+game_render(void)
+{
+    g_clear();
+
+    for (int i = 0; i < game.nasteroids; i++) {
+        struct asteroid *a = game.asteroids + i;
+        float x = coord_f(a->x);
+        float y = coord_f(a->y);
+        int mask = g_wmask(x, y, a->scale);
+        if (!mask) continue;
+
+        int n = shapes[a->kind].n;
+        const struct v2 *v = shapes[a->kind].v[a->shape];
+        float px = a->scale / g_pixel;
+        if (!g_nolod && px < 1) {
+            g_wdot(x, y, C_ASTEROID);
+            continue;
+        }
+
+        // Drop alternate vertices while outline segments are too short,
+        // as long as at least four remain
+        struct v2 lod[COUNTOF(shapes[0].v[0])];
+        int step = 1;
+        while (!g_nolod && n/(2*step) >= 4 && 2*PI*px*step/n < LOD_SEGMENT) {
+            step *= 2;
+        }
+        if (step > 1) {
+            int m = 0;
+            for (int j = 0; j < n; j += step) {
+                lod[m++] = v[j];
+            }
+            v = lod;
+            n = m;
+        }
+
+        struct tf t = tf_scale(tf(a->a, x, y), a->scale);
+        g_wlineloop(v, n, t, C_ASTEROID, mask);
+    }
+
+    for (int i = 0; i < game.nshots; i++) {
+        float x = coord_f(game.shots[i].x);
+        float y = coord_f(game.shots[i].y);
+        g_wpoint(x, y, C_SHOT);
+    }
+
+    if (game.lives) {
+        float x = coord_f(game.px);
+        float y = coord_f(game.py);
+        struct tf ship_tf = tf(game.pa, x, y);
+        int mask = g_wmask(x, y, SHIP_SCALE);
+        g_wlineloop(ship, COUNTOF(ship), ship_tf, C_SHIP, mask);
+        // Flicker on a hash of the clock, leaving the simulation's RNG
+        // alone so that replays need not render
+        uint64_t flicker = hash64(HASH_INIT, &game.time, sizeof(game.time));
+        if ((game.controls & I_THRUST) && flicker>>63) {
+            g_wlinestrip(tail, COUNTOF(tail), ship_tf, C_THRUST, mask);
+        }
+    } else {
+    }
+
+    if (g_debris.enabled) {
+        g_debris_render(game.time, DEBRIS_TTL);
+    }
+    // Positions and angles go through the batch kernels in chunks
+    for (int b = 0; !g_debris.enabled && b < game.ndebris; b += 256) {
+        float x[256], y[256], a[256], c[256], s[256];
+        int n = game.ndebris - b;
+        n = n < COUNTOF(x) ? n : COUNTOF(x);
+        for (int i = 0; i < n; i++) {
+            struct debris *d = game.debris + b + i;
+            x[i] = d->x + d->age*d->dx;
+            y[i] = d->y + d->age*d->dy;
+            a[i] = d->age*d->da;
+        }
+        wrapv(x, n);
+        wrapv(y, n);
+        cisv(c, s, a, n);
+
+        for (int i = 0; i < n; i++) {
+            struct debris *d = game.debris + b + i;
+            uint32_t alpha = 255 * (1 - d->age/DEBRIS_TTL);
+            if (!g_nolod && !alpha) continue;
+            uint32_t color = d->color | alpha<<24;
+
+            float ex = (d->v[1].x - d->v[0].x) / 2;
+            float ey = (d->v[1].y - d->v[0].y) / 2;
+            float r2 = ex*ex + ey*ey;
+            float mx = (d->v[0].x + d->v[1].x) / 2;
+            float my = (d->v[0].y + d->v[1].y) / 2;
+            float r = sqrtf(r2) + sqrtf(mx*mx + my*my);
+            int mask = g_wmask(x[i], y[i], r);
+            if (!mask) continue;
+
+            struct tf t = {.c = c[i], .s = s[i], .tx = x[i], .ty = y[i]};
+            if (!g_nolod && 4*r2 < g_pixel*g_pixel) {
+                struct v2 p = tf_apply(t, (struct v2){mx, my});
+                g_wdot(p.x, p.y, color);
+            } else {
+                g_wlinestrip(d->v, COUNTOF(d->v), t, color, mask);
+            }
+        }
     }
 
     char score[32];
@@ -709,7 +2431,7 @@ game_render(void)
         }
     }
 
-    g_render();
+    g_flush();
 }
 
 static BOOL win32_opengl_initialized;
@@ -734,29 +2456,35 @@ win32_opengl_init(HDC hdc)
     win32_opengl_initialized = TRUE;
 }
 
+static int
+key_control(WPARAM key)
+{
+    switch (key) {
+    case VK_LEFT:  return I_TURNL;
+    case VK_RIGHT: return I_TURNR;
+    case VK_UP:    return I_THRUST;
+    case VK_SPACE: return I_FIRE;
+    }
+    return 0;
+}
+
 static LRESULT CALLBACK
 win32_wndproc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
     switch (msg) {
         case WM_CREATE:
             win32_opengl_init(GetDC(hwnd));
-            game_init(win32_opengl_size);
+            game_init();
+            g_init(win32_opengl_size);
             break;
         case WM_KEYUP:
-            switch (wparam) {
-            case VK_LEFT:  game_up(I_TURNL);  break;
-            case VK_RIGHT: game_up(I_TURNR);  break;
-            case VK_UP:    game_up(I_THRUST); break;
-            case VK_SPACE: game_up(I_FIRE);   break;
+            if (!input.raw) {
+                game_up(key_control(wparam));
             }
             break;
         case WM_KEYDOWN:
-            if (lparam & 0x40000000) break;
-            switch (wparam) {
-            case VK_LEFT:  game_down(I_TURNL);  break;
-            case VK_RIGHT: game_down(I_TURNR);  break;
-            case VK_UP:    game_down(I_THRUST); break;
-            case VK_SPACE: game_down(I_FIRE);   break;
+            if (!input.raw && !(lparam & 0x40000000)) {
+                game_down(key_control(wparam));
             }
             break;
         case WM_CLOSE:
@@ -855,13 +2583,95 @@ joystick_read(int bits)
                 break;
             }
             switch (k.Flags) {
-            case XINPUT_KEYSTROKE_KEYDOWN: game_down(control); break;
-            case XINPUT_KEYSTROKE_KEYUP:   game_up(control);   break;
+            case XINPUT_KEYSTROKE_KEYDOWN: input_push(control, TRUE);  break;
+            case XINPUT_KEYSTROKE_KEYUP:   input_push(control, FALSE); break;
             }
         }
     }
 }
 
+/* Raw keyboard input for the message-only window on the input thread.
+ * Input is sunk even when unfocused, so keep only what arrives while
+ * the game window is in front.
+ */
+static LRESULT CALLBACK
+input_wndproc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
+{
+    if (msg != WM_INPUT) {
+        return DefWindowProc(hwnd, msg, wparam, lparam);
+    }
+    RAWINPUT raw;
+    UINT len = sizeof(raw);
+    UINT hdr = sizeof(RAWINPUTHEADER);
+    UINT r = GetRawInputData((HRAWINPUT)lparam, RID_INPUT, &raw, &len, hdr);
+    if (r == -1u || raw.header.dwType != RIM_TYPEKEYBOARD) {
+        return 0;
+    }
+    int control = key_control(raw.data.keyboard.VKey);
+    int down = !(raw.data.keyboard.Flags & RI_KEY_BREAK);
+    if (down && GetForegroundWindow() != input.window) {
+        return 0;  // releases always pass so keys never stick
+    }
+    if (!!(input.keys & control) == down) {
+        return 0;  // auto-repeat, or a release already reported
+    }
+    input.keys ^= control;
+    input_push(control, down);
+    return 0;
+}
+
+/* Gather keyboard and gamepad input independent of the frame rate. */
+static DWORD WINAPI
+input_thread(LPVOID arg)
+{
+    int joysticks = (intptr_t)arg;
+    WNDCLASS wndclass = {
+        .lpfnWndProc = input_wndproc,
+        .lpszClassName = "input",
+    };
+    RegisterClass(&wndclass);
+    HWND wnd = CreateWindow("input", 0, 0, 0, 0, 0, 0, HWND_MESSAGE, 0, 0, 0);
+    RAWINPUTDEVICE rid = {
+        .usUsagePage = 0x01,  // generic desktop
+        .usUsage = 0x06,      // keyboard
+        .dwFlags = RIDEV_INPUTSINK,
+        .hwndTarget = wnd,
+    };
+    input.raw = wnd && RegisterRawInputDevices(&rid, 1, sizeof(rid));
+    SetEvent(input.ready);
+
+    for (;;) {
+        // XInput has no event to wait on, so wake at least every 1ms
+        MsgWaitForMultipleObjects(0, 0, FALSE, 1, QS_ALLINPUT);
+        MSG msg;
+        while (PeekMessage(&msg, 0, 0, 0, TRUE)) {
+            DispatchMessage(&msg);
+        }
+        joystick_read(joysticks);
+    }
+    return 0;
+}
+
+/* Start the input thread. Called before the window's message loop
+ * runs, and waits until the thread has decided whether keys come from
+ * raw input, so that WM_KEYDOWN never sees input.raw change under it
+ * and no key is applied from both sources.
+ */
+static void
+input_init(HWND wnd)
+{
+    input.window = wnd;
+    input.ready = CreateEvent(0, TRUE, FALSE, 0);
+    int joysticks = joystick_discovery();
+    HANDLE thread = CreateThread(0, 0, input_thread,
+                                 (LPVOID)(intptr_t)joysticks, 0, 0);
+    if (thread) {
+        SetThreadPriority(thread, THREAD_PRIORITY_HIGHEST);
+        WaitForSingleObject(input.ready, INFINITE);
+        CloseHandle(thread);
+    }
+}
+
 static IDirectSoundBuffer *win32_dsb;
 
 static void *
@@ -943,6 +2753,14 @@ win32_audio_mix(int16_t *buf, size_t len)
     IDirectSoundBuffer_Unlock(win32_dsb, p0, z1, p1, z1);
 }
 
+static void *
+win32_alloc(size_t len)
+{
+    void *p = VirtualAlloc(0, len, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
+    if (!p) FATAL("Out of memory");
+    return p;
+}
+
 static double
 counter_freq(void)
 {
@@ -959,37 +2777,2068 @@ counter_now(void)
     return t.QuadPart;
 }
 
-int WINAPI
-WinMain(HINSTANCE h, HINSTANCE prev, LPSTR cmd, int show)
+#define ISSPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+/* Return the next whitespace-delimited argument, or null at the end.
+ * Also tokenizes text files.
+ */
+static char *
+nextarg(char **cmd)
 {
-    (void)h; (void)prev; (void)cmd; (void)show;
+    char *p = *cmd;
+    while (ISSPACE(*p)) p++;
+    if (!*p) return 0;
+    if (*p == '"') {
+        char *arg = ++p;
+        while (*p && *p != '"') p++;
+        if (*p) *p++ = 0;
+        *cmd = p;
+        return arg;
+    }
+    char *arg = p;
+    while (*p && !ISSPACE(*p)) p++;
+    if (*p) *p++ = 0;
+    *cmd = p;
+    return arg;
+}
 
-    HWND wnd = win32_window_init();
+/* Parse a non-negative integer argument, or return -1. */
+static long
+argtol(const char *s)
+{
+    long n = 0;
+    if (!s || !*s) return -1;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9' || n > 100000000) return -1;
+        n = n*10 + *s - '0';
+    }
+    return n;
+}
 
-    sound_init(wnd);
+/* Output buffer that truncates when full, always leaving room to null
+ * terminate DATA at LEN.
+ */
+struct buf {
+    char data[4096];
+    int len;
+};
 
-    int joysticks = joystick_discovery();
+static void
+buf_str(struct buf *b, const char *s)
+{
+    for (; *s && b->len < COUNTOF(b->data) - 1; s++) {
+        b->data[b->len++] = *s;
+    }
+}
 
-    timeBeginPeriod(1);
-    double freq = counter_freq();
+/* Append an integer right-aligned to WIDTH columns. */
+static void
+buf_ll(struct buf *b, long long n, int width)
+{
+    char tmp[32];
+    int len = lltostr(tmp, n);
+    for (; len < width; width--) {
+        buf_str(b, " ");
+    }
+    buf_str(b, tmp);
+}
 
-    HDC hdc = GetDC(wnd);
-    for (;;) {
-        double start = counter_now();
+/* Write the buffer to standard output, or a message box without one. */
+static void
+buf_flush(struct buf *b, const char *title)
+{
+    DWORD n;
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (!out || out == INVALID_HANDLE_VALUE ||
+        !WriteFile(out, b->data, b->len, &n, 0)) {
+        b->data[b->len] = 0;
+        MessageBoxA(0, b->data, title, MB_OK);
+    }
+    b->len = 0;
+}
 
-        MSG msg;
-        while (PeekMessage(&msg, 0, 0, 0, TRUE)) {
-            if (msg.message == WM_QUIT) {
-                TerminateProcess(GetCurrentProcess(), 0);
-            }
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
+/* Live state export: each tick the game copies a compact snapshot into
+ * a named shared memory section guarded by a seqlock. Any number of
+ * local readers map it read-only and retry any copy that overlapped a
+ * write, so the writer never waits on a reader.
+ */
+#define PUBLISH_NAME  "Local\\AsteroidsState"
+#define PUBLISH_MAGIC 0x32747361  // "ast2"
+
+struct publish_header {
+    uint32_t magic;
+    volatile uint32_t seq;  // odd while a write is in progress
+    uint32_t writer;        // process ID of the publishing game
+    int32_t maxasteroids;
+    int32_t maxshots;
+    uint64_t tick;
+    uint64_t publishes;
+    double publish_seconds; // total spent publishing
+    long long score;
+    int32_t level, lives;
+    float px, py, pa;
+    int32_t nasteroids, nshots;
+};
+struct publish_asteroid { float x, y, a, scale; };
+struct publish_shot { float x, y; };
+
+static struct {
+    BOOL enabled;
+    BOOL spectate;
+    struct publish_header *header;
+    struct publish_asteroid *asteroids;
+    struct publish_shot *shots;
+} publish;
+
+static size_t
+publish_size(int maxasteroids, int maxshots)
+{
+    return sizeof(struct publish_header) +
+           maxasteroids*sizeof(struct publish_asteroid) +
+           maxshots*sizeof(struct publish_shot);
+}
+
+/* Point the publish arrays at their place in the section after H, for
+ * a game with room for MAXASTEROIDS.
+ */
+static void
+publish_layout(struct publish_header *h, int maxasteroids)
+{
+    publish.header = h;
+    publish.asteroids = (struct publish_asteroid *)(h + 1);
+    publish.shots = (struct publish_shot *)
+                    (publish.asteroids + maxasteroids);
+}
+
+/* Size of the view mapped at P, rounded up to whole pages. */
+static size_t
+view_size(const void *p)
+{
+    MEMORY_BASIC_INFORMATION info;
+    return VirtualQuery(p, &info, sizeof(info)) ? info.RegionSize : 0;
+}
+
+/* Whether process PID is still running. A reused ID can only make this
+ * err toward true.
+ */
+static BOOL
+process_alive(DWORD pid)
+{
+    HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    BOOL alive = h && WaitForSingleObject(h, 0) == WAIT_TIMEOUT;
+    if (h) CloseHandle(h);
+    return alive;
+}
+
+/* Create the section, or take over one left by a game that has exited
+ * while a reader still holds it open. Setup is itself a seqlock write,
+ * which also leaves the sequence even if that game died mid-write.
+ */
+static void
+publish_init(void)
+{
+    size_t len = publish_size(game.maxasteroids, game.maxshots);
+    HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE,
+                                  0, len, PUBLISH_NAME);
+    BOOL existed = GetLastError() == ERROR_ALREADY_EXISTS;
+    struct publish_header *p = 0;
+    if (h) {
+        p = MapViewOfFile(h, FILE_MAP_WRITE, 0, 0, 0);
+    }
+    if (!p) FATAL("Could not create the shared state section");
+    if (view_size(p) < len) {
+        FATAL("The shared state section is too small for this game");
+    }
+    if (existed && p->magic == PUBLISH_MAGIC && process_alive(p->writer)) {
+        FATAL("Another game is already publishing its state");
+    }
+
+    p->seq |= 1;
+    MemoryBarrier();  // mark the write before touching the header
+    p->writer = GetCurrentProcessId();
+    p->maxasteroids = game.maxasteroids;
+    p->maxshots = game.maxshots;
+    p->nasteroids = p->nshots = 0;
+    p->magic = PUBLISH_MAGIC;
+    publish_layout(p, game.maxasteroids);
+    MemoryBarrier();  // finish the header before releasing it
+    p->seq++;
+}
+
+/* Copy this tick's state into the section. Never blocks. */
+static void
+publish_tick(void)
+{
+    double start = counter_now();
+    struct publish_header *h = publish.header;
+    h->seq++;
+    MemoryBarrier();  // mark the write before touching the data
+
+    h->tick = game.tick;
+    h->score = game.score;
+    h->level = game.level;
+    h->lives = game.lives;
+    h->px = coord_f(game.px);
+    h->py = coord_f(game.py);
+    h->pa = game.pa;
+    h->nasteroids = game.nasteroids;
+    for (int i = 0; i < game.nasteroids; i++) {
+        struct asteroid *a = game.asteroids + i;
+        struct publish_asteroid *p = publish.asteroids + i;
+        p->x = coord_f(a->x);
+        p->y = coord_f(a->y);
+        p->a = a->a;
+        p->scale = a->scale;
+    }
+    h->nshots = game.nshots;
+    for (int i = 0; i < game.nshots; i++) {
+        publish.shots[i].x = coord_f(game.shots[i].x);
+        publish.shots[i].y = coord_f(game.shots[i].y);
+    }
+    h->publishes++;
+    h->publish_seconds += (counter_now() - start) / counter_freq();
+
+    MemoryBarrier();  // finish the data before releasing it
+    h->seq++;
+}
+
+/* Sample reader: map the section read-only and take consistent
+ * snapshots as fast as possible for the configured number of seconds,
+ * then report reader throughput and the publisher's overhead. Counts
+ * are clamped to the layout in use, and a snapshot from a new writer or
+ * with a different layout, after a takeover, is retaken in its layout.
+ */
+static int
+spectate_run(void)
+{
+    HANDLE m = OpenFileMappingA(FILE_MAP_READ, FALSE, PUBLISH_NAME);
+    struct publish_header *h = 0;
+    if (m) {
+        h = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!h || h->magic != PUBLISH_MAGIC) {
+        FATAL("No game is publishing its state (run it with -publish)");
+    }
+    struct publish_header snap = *h;
+    struct publish_asteroid *asteroids = 0;
+    struct publish_shot *shots = 0;
+    size_t cap = 0;
+    int maxa = -1, maxs = -1;
+    uint32_t writer = 0;
+
+    long long snapshots = 0, retries = 0, ticks = 0, bytes = 0;
+    uint64_t last = 0;
+    double freq = counter_freq();
+    double start = counter_now();
+    double stop = start + stress.seconds*freq;
+    while (counter_now() < stop) {
+        for (;;) {
+            uint32_t seq = h->seq;
+            MemoryBarrier();  // read the sequence before the data
+            if (snap.writer != writer || snap.maxasteroids != maxa ||
+                snap.maxshots != maxs) {
+                // First snapshot, or a new game took over the section
+                maxa = snap.maxasteroids;
+                maxs = snap.maxshots;
+                writer = snap.writer;
+                size_t len = publish_size(maxa, maxs);
+                if (maxa < 0 || maxs < 0 || view_size(h) < len) {
+                    FATAL("The shared state section is smaller than its "
+                          "header claims");
+                }
+                if (len > cap) {
+                    if (asteroids) VirtualFree(asteroids, 0, MEM_RELEASE);
+                    asteroids = win32_alloc(len);
+                    cap = len;
+                }
+                shots = (void *)(asteroids + maxa);
+                publish_layout(h, maxa);
+            }
+            if (!(seq & 1)) {
+                snap = *h;
+                int na = snap.nasteroids;
+                int ns = snap.nshots;
+                na = na < 0 ? 0 : na > maxa ? maxa : na;
+                ns = ns < 0 ? 0 : ns > maxs ? maxs : ns;
+                memcpy(asteroids, publish.asteroids, na*sizeof(*asteroids));
+                memcpy(shots, publish.shots, ns*sizeof(*shots));
+                MemoryBarrier();  // finish the data before rechecking
+                if (h->seq == seq && snap.writer == writer &&
+                    snap.maxasteroids == maxa && snap.maxshots == maxs) {
+                    bytes += sizeof(snap) + na*sizeof(*asteroids) +
+                             ns*sizeof(*shots);
+                    break;
+                }
+                if (h->seq == seq) continue;  // retake in the new layout
+            }
+            retries++;
+        }
+        snapshots++;
+        ticks += snap.tick != last;
+        last = snap.tick;
+    }
+    double seconds = (counter_now() - start) / freq;
+
+    struct buf b = {0};
+    buf_str(&b, "snapshots/s ");
+    buf_ll(&b, snapshots / seconds, 0);
+    buf_str(&b, ", MB/s ");
+    buf_ll(&b, bytes / seconds / 1e6, 0);
+    buf_str(&b, ", retries ");
+    buf_ll(&b, retries, 0);
+    buf_str(&b, ", ticks seen ");
+    buf_ll(&b, ticks, 0);
+    buf_str(&b, "\nlast tick ");
+    buf_ll(&b, snap.tick, 0);
+    buf_str(&b, ": level ");
+    buf_ll(&b, snap.level, 0);
+    buf_str(&b, ", score ");
+    buf_ll(&b, snap.score, 0);
+    buf_str(&b, ", asteroids ");
+    buf_ll(&b, snap.nasteroids, 0);
+    buf_str(&b, ", shots ");
+    buf_ll(&b, snap.nshots, 0);
+    buf_str(&b, "\npublisher ns/tick ");
+    double pub = snap.publishes ? snap.publish_seconds/snap.publishes : 0;
+    buf_ll(&b, 1e9*pub, 0);
+    buf_str(&b, "\n");
+    buf_flush(&b, "Spectate Results");
+    return 0;
+}
+
+/* Keep the configured number of shots and debris in flight. */
+static void
+stress_populate(void)
+{
+    while (game.nshots < stress.nshots && game.nshots < game.maxshots) {
+        struct shot *s = game.shots + game.nshots++;
+        struct v2 u = cis(2*PI*randu());
+        s->x = coord_of(randu());
+        s->y = coord_of(randu());
+        s->dx = velocity_of(SHOT_SPEED*u.x);
+        s->dy = velocity_of(SHOT_SPEED*u.y);
+        s->ttl = SHOT_TTL*randu();
+    }
+    // The first fill spreads ages, oldest first, so that expiries are
+    // staggered. Refills replace expired fragments with new ones.
+    int fill = stress.ndebris - game.ndebris;
+    BOOL spread = !game.ndebris;
+    if (spread) {
+        g_debris_clear();
+    }
+    for (int i = 0; i < fill; i++) {
+        float f = 0.01f;
+        struct v2 v[] = {
+            {f*(2*randu() - 1), f*(2*randu() - 1)},
+            {f*(2*randu() - 1), f*(2*randu() - 1)},
+        };
+        float dx = 0.1f*(2*randu() - 1);
+        float dy = 0.1f*(2*randu() - 1);
+        float da = 2*PI*(2*randu() - 1);
+        float age = spread ? DEBRIS_TTL*(fill - i)/(fill + 1) : 0;
+        game_debris(v, randu(), randu(), dx, dy, da, age, C_FIRE);
+    }
+}
+
+/* Run the scripted stress scenario at a fixed time step and report
+ * per-stage timings.
+ */
+static void
+stress_run(HDC hdc)
+{
+    double freq = counter_freq();
+    double now = game.last;
+    long ticks = stress.seconds * FRAMERATE;
+    long long entities = 0;
+
+    game_down(I_FIRE);
+    game_down(I_TURNL);
+
+    double start = counter_now();
+    for (long t = 0; t < ticks; t++) {
+        MSG msg;
+        while (PeekMessage(&msg, 0, 0, 0, TRUE)) {
+            if (msg.message == WM_QUIT) {
+                TerminateProcess(GetCurrentProcess(), 0);
+            }
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+
+        stress_populate();
+        entities += game.nasteroids + game.nshots + game.ndebris;
+
+        now += 1.0 / FRAMERATE;
+        stress.mark = counter_now();
+        game_step(now);
+        if (publish.enabled) {
+            publish_tick();
+        }
+        stress_mark(STAGE_PUBLISH, publish.enabled ? game.nasteroids : 0);
+        game_render();
+        stress_mark(STAGE_RENDER, game.nasteroids+game.nshots+game.ndebris);
+        SwapBuffers(hdc);
+    }
+    double total = counter_now() - start;
+
+    struct buf b = {0};
+    buf_str(&b, "stress: ");
+    buf_ll(&b, stress.nasteroids, 0);
+    buf_str(&b, " asteroids, ");
+    buf_ll(&b, stress.nshots, 0);
+    buf_str(&b, " shots, ");
+    buf_ll(&b, stress.ndebris, 0);
+    buf_str(&b, " debris, ");
+    buf_ll(&b, ticks, 0);
+    buf_str(&b, " ticks\n");
+    buf_str(&b, "stage          ns/tick    work/tick   Mwork/s\n");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        double sec = stress.time[s] / freq;
+        buf_str(&b, stage_names[s]);
+        buf_ll(&b, 1e9 * sec / ticks, 18 - (int)strlen(stage_names[s]));
+        buf_ll(&b, stress.work[s] / ticks, 13);
+        buf_ll(&b, sec > 0 ? stress.work[s] / sec / 1e6 : 0, 10);
+        buf_str(&b, "\n");
+    }
+    buf_str(&b, "total");
+    buf_ll(&b, 1e9 * total / freq / ticks, 13);
+    buf_ll(&b, entities / ticks, 13);
+    buf_ll(&b, entities / (total / freq) / 1e6, 10);
+    buf_str(&b, g_nolod ? "\nLOD off" : "\nLOD on");
+    if (g_debris.enabled) {
+        buf_str(&b, ", GPU debris, ");
+        buf_ll(&b, g_debris.dropped, 0);
+        buf_str(&b, " dropped");
+    } else {
+        buf_str(&b, ", CPU debris");
+    }
+    buf_str(&b, ", " COORD_NAME " positions");
+    buf_str(&b, ", vertices/tick ");
+    buf_ll(&b, g_vertextotal / ticks, 0);
+    buf_str(&b, ", indices/tick ");
+    buf_ll(&b, g_indextotal / ticks, 0);
+    buf_str(&b, "\n");
+    buf_flush(&b, "Stress Results");
+}
+
+/* Append a 64-bit integer in hexadecimal. */
+static void
+buf_hex(struct buf *b, uint64_t x)
+{
+    char tmp[17];
+    for (int i = 15; i >= 0; i--) {
+        tmp[i] = "0123456789abcdef"[x & 15];
+        x >>= 4;
+    }
+    tmp[16] = 0;
+    buf_str(b, tmp);
+}
+
+static int
+parsehex(const char *s, uint64_t *x)
+{
+    *x = 0;
+    if (!s || !*s) return 0;
+    for (; *s; s++) {
+        int d = *s >= '0' && *s <= '9' ? *s - '0' :
+                *s >= 'a' && *s <= 'f' ? *s - 'a' + 10 : -1;
+        if (d < 0) return 0;
+        *x = *x<<4 | d;
+    }
+    return 1;
+}
+
+/* Write LEN bytes to a new file at PATH. Returns non-zero on success. */
+static int
+write_file(const char *path, const void *buf, DWORD len)
+{
+    DWORD n;
+    HANDLE h = CreateFileA(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, 0);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    BOOL ok = WriteFile(h, buf, len, &n, 0) && n == len;
+    CloseHandle(h);
+    return ok;
+}
+
+/* Read a file at PATH into a new null-terminated buffer, or null if it
+ * can't be read or is larger than MAX bytes.
+ */
+static char *
+read_file(const char *path, DWORD *len, DWORD max)
+{
+    DWORD n;
+    HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    DWORD hi;
+    *len = GetFileSize(h, &hi);
+    if (*len == INVALID_FILE_SIZE || hi || *len > max) {
+        CloseHandle(h);
+        return 0;
+    }
+    char *buf = win32_alloc(*len + 1);
+    BOOL ok = ReadFile(h, buf, *len, &n, 0) && n == *len;
+    CloseHandle(h);
+    if (!ok) {
+        VirtualFree(buf, 0, MEM_RELEASE);
+        return 0;
+    }
+    buf[*len] = 0;
+    return buf;
+}
+
+/* Regression check: seeded scenarios run headless at a fixed time step
+ * with scripted controls, recording hashes of the final state, of all
+ * rendered geometry, and of a CPU-rasterized final frame, along with
+ * ns/tick. Only the final frame is rasterized, so the timing is of the
+ * game rather than the rasterizer. -checkinit writes the baseline file,
+ * with a PPM of each golden frame beside it for review. -check fails if
+ * the baseline is missing, on any hash mismatch, or when slower than
+ * the baseline by more than the threshold percentage.
+ */
+#define CHECK_SIZE 512
+#define CHECK_REPS 3
+
+static const struct scenario {
+    char name[8];
+    unsigned long long seed;
+    int ticks;
+    int controls;
+} scenarios[] = {
+    {"idle",   1,  600, 0},
+    {"fire",   2, 1800, I_FIRE | I_TURNL},
+    {"thrust", 3, 1800, I_THRUST | I_TURNR | I_FIRE},
+};
+
+static struct {
+    char *baseline;
+    BOOL init;          // write the baseline rather than compare to it
+    int threshold;
+} check = {.threshold = 25};
+
+struct check_result {
+    uint64_t state, lines, frame;
+    long long ns;
+};
+
+static void
+check_scenario(const struct scenario *sc, struct check_result *r)
+{
+    double freq = counter_freq();
+    long long best = -1;
+    uint8_t *raster = g_raster;
+    for (int rep = 0; rep < CHECK_REPS; rep++) {
+        game.seed = sc->seed;
+        game_start();
+        game.last = 0;
+        for (int c = 1; c <= sc->controls; c <<= 1) {
+            if (sc->controls & c) game_down(c);
+        }
+
+        g_hash = HASH_INIT;
+        double start = counter_now();
+        for (int t = 1; t <= sc->ticks; t++) {
+            game_step((double)t / FRAMERATE);
+            g_raster = t == sc->ticks ? raster : 0;
+            game_render();
+        }
+        long long ns = 1e9 * (counter_now() - start) / freq / sc->ticks;
+
+        struct check_result this = {
+            .state = game_hash(),
+            .lines = g_hash,
+            .frame = hashv(HASH_INIT, raster, CHECK_SIZE*CHECK_SIZE*3),
+        };
+        if (rep && (this.state != r->state || this.lines != r->lines ||
+                    this.frame != r->frame)) {
+            FATAL("Scenario is not deterministic");
+        }
+        *r = this;
+        best = rep && best < ns ? best : ns;
+    }
+    r->ns = best;
+}
+
+static int check_record(struct buf *);
+
+static int
+check_run(void)
+{
+    static uint8_t raster[CHECK_SIZE*CHECK_SIZE*3];
+    g_headless = TRUE;
+    g_raster = raster;
+    g_rsize = CHECK_SIZE;
+    game_alloc();
+    shapes_init();
+    g_init(CHECK_SIZE);
+
+    struct buf b = {0};
+    DWORD len;
+    char *text = 0;
+    if (!check.init) {
+        text = read_file(check.baseline, &len, 1 << 20);
+        if (!text) {
+            buf_str(&b, "No baseline at ");
+            buf_str(&b, check.baseline);
+            buf_str(&b, ", create it with -checkinit\nFAIL\n");
+            buf_flush(&b, "Check Results");
+            return 1;
+        }
+    }
+
+    // Parse the baseline in scenario order
+    struct check_result want[COUNTOF(scenarios)];
+    for (int i = 0; i < COUNTOF(scenarios); i++) {
+        want[i].ns = -1;
+    }
+    for (char *p = text, *name; text && (name = nextarg(&p));) {
+        char *fields[4];
+        for (int f = 0; f < 4; f++) {
+            fields[f] = nextarg(&p);
+        }
+        for (int i = 0; i < COUNTOF(scenarios); i++) {
+            struct check_result *w = want + i;
+            if (!strcmp(name, scenarios[i].name) &&
+                parsehex(fields[0], &w->state) &&
+                parsehex(fields[1], &w->lines) &&
+                parsehex(fields[2], &w->frame)) {
+                w->ns = argtol(fields[3]);
+            }
+        }
+    }
+
+    struct buf out = {0};
+    int fail = 0;
+
+    buf_str(&b, "scenario  state             lines             "
+                "frame                ns/tick\n");
+    for (int i = 0; i < COUNTOF(scenarios); i++) {
+        const struct scenario *sc = scenarios + i;
+        struct check_result r = {0};
+        check_scenario(sc, &r);
+
+        buf_str(&out, sc->name);
+        buf_str(&out, " ");
+        buf_hex(&out, r.state);
+        buf_str(&out, " ");
+        buf_hex(&out, r.lines);
+        buf_str(&out, " ");
+        buf_hex(&out, r.frame);
+        buf_str(&out, " ");
+        buf_ll(&out, r.ns, 0);
+        buf_str(&out, "\n");
+
+        buf_str(&b, sc->name);
+        for (int n = strlen(sc->name); n < 10; n++) {
+            buf_str(&b, " ");
+        }
+        buf_hex(&b, r.state);
+        buf_str(&b, "  ");
+        buf_hex(&b, r.lines);
+        buf_str(&b, "  ");
+        buf_hex(&b, r.frame);
+        buf_ll(&b, r.ns, 12);
+
+        if (!text) {
+            struct buf path = {0};
+            buf_str(&path, check.baseline);
+            buf_str(&path, "-");
+            buf_str(&path, sc->name);
+            buf_str(&path, ".ppm");
+            path.data[path.len] = 0;
+            struct buf ppm = {0};
+            buf_str(&ppm, "P6\n");
+            buf_ll(&ppm, CHECK_SIZE, 0);
+            buf_str(&ppm, " ");
+            buf_ll(&ppm, CHECK_SIZE, 0);
+            buf_str(&ppm, "\n255\n");
+            static uint8_t image[64 + sizeof(raster)];
+            memcpy(image, ppm.data, ppm.len);
+            memcpy(image + ppm.len, raster, sizeof(raster));
+            if (!write_file(path.data, image, ppm.len + sizeof(raster))) {
+                FATAL("Could not write golden frame");
+            }
+            buf_str(&b, "  new\n");
+            continue;
+        }
+
+        struct check_result *w = want + i;
+        if (w->ns < 0) {
+            buf_str(&b, "  MISSING\n");
+            fail = 1;
+        } else if (w->state != r.state) {
+            buf_str(&b, "  STATE\n");
+            fail = 1;
+        } else if (w->lines != r.lines) {
+            buf_str(&b, "  LINES\n");
+            fail = 1;
+        } else if (w->frame != r.frame) {
+            buf_str(&b, "  FRAME\n");
+            fail = 1;
+        } else if (r.ns*100 > w->ns*(100 + check.threshold)) {
+            buf_str(&b, "  SLOWER than ");
+            buf_ll(&b, w->ns, 0);
+            buf_str(&b, "\n");
+            fail = 1;
+        } else {
+            buf_str(&b, "  ok\n");
+        }
+    }
+
+    fail |= check_record(&b);
+
+    if (!text && !write_file(check.baseline, out.data, out.len)) {
+        FATAL("Could not write baseline");
+    }
+    buf_str(&b, fail ? "FAIL\n" : "PASS\n");
+    buf_flush(&b, "Check Results");
+    return fail;
+}
+
+/* Capture: each rendered frame is copied into a ring of preallocated
+ * RGBA slots, and a writer thread converts them to 4:2:0 YUV and
+ * streams them into a Y4M file, so encoding never runs on the game
+ * thread. Live capture drops a frame rather than stall when the ring
+ * is full, and the writer repeats the previous frame in its place to
+ * keep the video on the 60 Hz timeline. Headless capture waits for a
+ * free slot instead. Live frames are read back through a pair of pixel
+ * buffer objects, collecting each frame one frame late so the transfer
+ * never stalls the pipeline. Sounds are logged as sample offsets while
+ * playing and mixed into a WAV file when capture ends.
+ */
+#define CAPTURE_FRAMES 8
+#define CAPTURE_SOUNDS (1 << 16)
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#  define GL_PIXEL_PACK_BUFFER  0x88eb
+#  define GL_STREAM_READ        0x88e1
+#  define GL_READ_ONLY          0x88b8
+#endif
+
+static struct {
+    char *name;
+    int width, height;          // frame dimensions, even
+    BOOL lossless;              // wait for the writer instead of dropping
+    BOOL flip;                  // frames arrive bottom row first
+    GLuint pbo[2];              // zero when reading back synchronously
+    struct {
+        uint8_t *rgba;
+        int gap;                // drops just before, repeating the last
+    } slots[CAPTURE_FRAMES];
+    uint8_t *yuv;
+    HANDLE y4m;
+    HANDLE free, full;          // semaphores counting ring slots
+    HANDLE thread;
+    volatile long head;         // frames committed, game thread only
+    volatile BOOL done;
+    long tail;                  // frames written, writer only
+    int pending;                // drops since the last committed frame
+    long frames, written, dropped;
+    struct capture_event {
+        long sample;
+        const int16_t *pcm;
+        int len;
+    } *sounds;
+    int nsounds;
+} capture;
+
+/* BT.601 full range, matching the C420jpeg tag: 8-bit fixed point with
+ * the chroma bias folded into a constant that can't overflow a byte.
+ */
+static uint8_t
+yuv_y(const uint8_t *p)
+{
+    return (77*p[0] + 150*p[1] + 29*p[2] + 128) >> 8;
+}
+
+static uint8_t
+yuv_u(const uint8_t *p)
+{
+    return (-43*p[0] - 85*p[1] + 128*p[2] + 32895) >> 8;
+}
+
+static uint8_t
+yuv_v(const uint8_t *p)
+{
+    return (128*p[0] - 107*p[1] - 21*p[2] + 32895) >> 8;
+}
+
+/* Average a 2x2 block of RGBA pixels the way _mm_avg_epu8 rounds. */
+static void
+yuv_avg(uint8_t *dst, const uint8_t *r0, const uint8_t *r1)
+{
+    for (int c = 0; c < 3; c++) {
+        int a = (r0[c] + r1[c] + 1) >> 1;
+        int b = (r0[c+4] + r1[c+4] + 1) >> 1;
+        dst[c] = (a + b + 1) >> 1;
+    }
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+/* Sum adjacent pairs of 32-bit lanes across A then B. */
+static __m128i
+hadd32(__m128i a, __m128i b)
+{
+    __m128 x = _mm_castsi128_ps(a);
+    __m128 y = _mm_castsi128_ps(b);
+    __m128 even = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 odd = _mm_shuffle_ps(x, y, _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+}
+
+/* Convert N RGBA pixels to luma, eight at a time. */
+static void
+yuv_luma(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+    __m128i zero = _mm_setzero_si128();
+    __m128i coef = _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+    __m128i bias = _mm_set1_epi32(128);
+    for (; i+8 <= n; i += 8) {
+        __m128i y[2];
+        for (int k = 0; k < 2; k++) {
+            __m128i p = _mm_loadu_si128((void *)(src + 4*i + 16*k));
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), coef);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), coef);
+            y[k] = _mm_srli_epi32(_mm_add_epi32(hadd32(lo, hi), bias), 8);
+        }
+        __m128i w = _mm_packs_epi32(y[0], y[1]);
+        _mm_storel_epi64((void *)(dst + i), _mm_packus_epi16(w, w));
+    }
+    for (; i < n; i++) {
+        dst[i] = yuv_y(src + 4*i);
+    }
+}
+
+/* Convert N pixels from two RGBA rows to N/2 chroma pairs. */
+static void
+yuv_chroma(uint8_t *u, uint8_t *v, const uint8_t *r0, const uint8_t *r1,
+           int n)
+{
+    int i = 0;
+    __m128i zero = _mm_setzero_si128();
+    __m128i ucoef = _mm_setr_epi16(-43, -85, 128, 0, -43, -85, 128, 0);
+    __m128i vcoef = _mm_setr_epi16(128, -107, -21, 0, 128, -107, -21, 0);
+    __m128i bias = _mm_set1_epi32(32895);
+    for (; i+8 <= n; i += 8) {
+        __m128i a = _mm_avg_epu8(_mm_loadu_si128((void *)(r0 + 4*i)),
+                                 _mm_loadu_si128((void *)(r1 + 4*i)));
+        __m128i b = _mm_avg_epu8(_mm_loadu_si128((void *)(r0 + 4*i + 16)),
+                                 _mm_loadu_si128((void *)(r1 + 4*i + 16)));
+        a = _mm_avg_epu8(a, _mm_srli_si128(a, 4));
+        b = _mm_avg_epu8(b, _mm_srli_si128(b, 4));
+        __m128i c = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a),
+                                                    _mm_castsi128_ps(b),
+                                                    _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i lo = _mm_unpacklo_epi8(c, zero);
+        __m128i hi = _mm_unpackhi_epi8(c, zero);
+        __m128i cu = hadd32(_mm_madd_epi16(lo, ucoef),
+                            _mm_madd_epi16(hi, ucoef));
+        __m128i cv = hadd32(_mm_madd_epi16(lo, vcoef),
+                            _mm_madd_epi16(hi, vcoef));
+        cu = _mm_srai_epi32(_mm_add_epi32(cu, bias), 8);
+        cv = _mm_srai_epi32(_mm_add_epi32(cv, bias), 8);
+        __m128i w = _mm_packs_epi32(cu, cv);
+        w = _mm_packus_epi16(w, w);
+        int32_t lanes[2] = {
+            _mm_cvtsi128_si32(w), _mm_cvtsi128_si32(_mm_srli_si128(w, 4))
+        };
+        memcpy(u + i/2, lanes + 0, 4);
+        memcpy(v + i/2, lanes + 1, 4);
+    }
+    for (; i < n; i += 2) {
+        uint8_t p[3];
+        yuv_avg(p, r0 + 4*i, r1 + 4*i);
+        u[i/2] = yuv_u(p);
+        v[i/2] = yuv_v(p);
+    }
+}
+#else
+static void
+yuv_luma(uint8_t *dst, const uint8_t *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] = yuv_y(src + 4*i);
+    }
+}
+
+static void
+yuv_chroma(uint8_t *u, uint8_t *v, const uint8_t *r0, const uint8_t *r1,
+           int n)
+{
+    for (int i = 0; i < n; i += 2) {
+        uint8_t p[3];
+        yuv_avg(p, r0 + 4*i, r1 + 4*i);
+        u[i/2] = yuv_u(p);
+        v[i/2] = yuv_v(p);
+    }
+}
+#endif
+
+/* Convert a W by H RGBA frame into planar I420. */
+static void
+capture_convert(uint8_t *yuv, const uint8_t *rgba, int w, int h, BOOL flip)
+{
+    int stride = w*4;
+    uint8_t *u = yuv + w*h;
+    uint8_t *v = u + w*h/4;
+    for (int y = 0; y < h; y++) {
+        int row = flip ? h - 1 - y : y;
+        yuv_luma(yuv + y*w, rgba + row*stride, w);
+    }
+    for (int y = 0; y < h; y += 2) {
+        int row = flip ? h - 2 - y : y;
+        const uint8_t *r0 = rgba + row*stride;
+        yuv_chroma(u + y/2*w/2, v + y/2*w/2,
+                   flip ? r0 + stride : r0, flip ? r0 : r0 + stride, w);
+    }
+}
+
+/* Write the most recently converted frame N times. */
+static void
+capture_write(int n)
+{
+    DWORD len = capture.width*capture.height*3/2;
+    for (int i = 0; i < n; i++) {
+        DWORD z;
+        WriteFile(capture.y4m, "FRAME\n", 6, &z, 0);
+        WriteFile(capture.y4m, capture.yuv, len, &z, 0);
+        capture.written++;
+    }
+}
+
+static DWORD WINAPI
+capture_thread(LPVOID arg)
+{
+    (void)arg;
+    for (;;) {
+        WaitForSingleObject(capture.full, INFINITE);
+        if (capture.done && capture.tail == capture.head) {
+            // Drops after the last committed frame repeat it too
+            capture_write(capture.pending);
+            break;
+        }
+        int slot = capture.tail % CAPTURE_FRAMES;
+        capture_write(capture.slots[slot].gap);
+        capture_convert(capture.yuv, capture.slots[slot].rgba,
+                        capture.width, capture.height, capture.flip);
+        capture_write(1);
+        capture.tail++;
+        ReleaseSemaphore(capture.free, 1, 0);
+    }
+    return 0;
+}
+
+/* Set up asynchronous readback through two pixel buffer objects, or
+ * leave capture.pbo zero to read back synchronously.
+ */
+static void
+capture_pbo_init(void)
+{
+    #define LOADGL(f) if (!(f##_p = (void *)wglGetProcAddress(#f))) return
+    LOADGL(glGenBuffers);
+    LOADGL(glBindBuffer);
+    LOADGL(glBufferData);
+    LOADGL(glMapBuffer);
+    LOADGL(glUnmapBuffer);
+    #undef LOADGL
+
+    glGenBuffers_p(2, capture.pbo);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer_p(GL_PIXEL_PACK_BUFFER, capture.pbo[i]);
+        glBufferData_p(GL_PIXEL_PACK_BUFFER,
+                       capture.width*capture.height*4, 0, GL_STREAM_READ);
+    }
+    glBindBuffer_p(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static void
+capture_begin(int width, int height, BOOL lossless, BOOL flip)
+{
+    struct buf b = {.len = 0};
+    buf_str(&b, capture.name);
+    buf_str(&b, ".y4m");
+    b.data[b.len] = 0;
+    capture.y4m = CreateFileA(b.data, GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, 0);
+    if (capture.y4m == INVALID_HANDLE_VALUE) {
+        FATAL("Could not create capture file");
+    }
+
+    capture.width = width & ~1;
+    capture.height = height & ~1;
+    capture.lossless = lossless;
+    capture.flip = flip;
+    int size = capture.width*capture.height;
+    for (int i = 0; i < CAPTURE_FRAMES; i++) {
+        capture.slots[i].rgba = win32_alloc(size*4);
+    }
+    capture.yuv = win32_alloc(size*3/2);
+    capture.sounds = win32_alloc(CAPTURE_SOUNDS*sizeof(*capture.sounds));
+    if (!g_raster) {
+        capture_pbo_init();
+    }
+
+    b.len = 0;
+    buf_str(&b, "YUV4MPEG2 W");
+    buf_ll(&b, capture.width, 0);
+    buf_str(&b, " H");
+    buf_ll(&b, capture.height, 0);
+    buf_str(&b, " F60:1 Ip A1:1 C420jpeg\n");
+    DWORD n;
+    WriteFile(capture.y4m, b.data, b.len, &n, 0);
+
+    capture.free = CreateSemaphoreA(0, CAPTURE_FRAMES, CAPTURE_FRAMES, 0);
+    capture.full = CreateSemaphoreA(0, 0, CAPTURE_FRAMES + 1, 0);
+    capture.thread = CreateThread(0, 0, capture_thread, 0, 0, 0);
+    if (!capture.free || !capture.full || !capture.thread) {
+        FATAL("Failed to start capture thread");
+    }
+}
+
+/* Claim the next ring slot for a frame, waiting if LOSSLESS. Returns
+ * null and counts a drop if none is free.
+ */
+static uint8_t *
+capture_claim(BOOL lossless)
+{
+    DWORD wait = lossless ? INFINITE : 0;
+    if (WaitForSingleObject(capture.free, wait) != WAIT_OBJECT_0) {
+        capture.dropped++;
+        capture.pending++;
+        return 0;
+    }
+    int slot = capture.head % CAPTURE_FRAMES;
+    capture.slots[slot].gap = capture.pending;
+    capture.pending = 0;
+    return capture.slots[slot].rgba;
+}
+
+/* Hand the claimed slot to the writer. */
+static void
+capture_commit(void)
+{
+    capture.head++;
+    ReleaseSemaphore(capture.full, 1, 0);
+}
+
+/* Copy the frame that landed in pixel buffer PBO into a slot. */
+static void
+capture_collect(GLuint pbo, BOOL lossless)
+{
+    uint8_t *dst = capture_claim(lossless);
+    if (dst) {
+        glBindBuffer_p(GL_PIXEL_PACK_BUFFER, pbo);
+        void *src = glMapBuffer_p(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (src) {
+            memcpy(dst, src, capture.width*capture.height*4);
+            glUnmapBuffer_p(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer_p(GL_PIXEL_PACK_BUFFER, 0);
+        capture_commit();
+    }
+}
+
+/* Grab the frame just rendered: from the raster when headless, else
+ * from the GL back buffer before it is swapped.
+ */
+static void
+capture_frame(void)
+{
+    int w = capture.width;
+    int h = capture.height;
+    capture.frames++;
+    if (capture.pbo[0]) {
+        // Start this frame's transfer, then collect the previous one,
+        // which has had a whole frame to arrive
+        GLuint next = capture.pbo[capture.frames%2];
+        GLuint prev = capture.pbo[(capture.frames + 1)%2];
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindBuffer_p(GL_PIXEL_PACK_BUFFER, next);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer_p(GL_PIXEL_PACK_BUFFER, 0);
+        if (capture.frames > 1) {
+            capture_collect(prev, capture.lossless);
+        }
+        return;
+    }
+
+    uint8_t *dst = capture_claim(capture.lossless);
+    if (!dst) {
+        return;
+    }
+    if (g_raster) {
+        for (int y = 0; y < h; y++) {
+            const uint8_t *src = g_raster + y*g_rsize*3;
+            uint8_t *row = dst + y*w*4;
+            for (int x = 0; x < w; x++) {
+                memcpy(row + x*4, src + x*3, 3);
+            }
+        }
+    } else {
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, dst);
+    }
+    capture_commit();
+}
+
+/* Log a sound starting with the frame about to be rendered. */
+static void
+capture_sound(const int16_t *pcm, int len)
+{
+    if (capture.sounds && capture.nsounds < CAPTURE_SOUNDS) {
+        struct capture_event *s = capture.sounds + capture.nsounds++;
+        s->sample = capture.frames * AUDIO_HZ / FRAMERATE;
+        s->pcm = pcm;
+        s->len = len;
+    }
+}
+
+static void
+put_le(uint8_t *p, uint32_t x, int n)
+{
+    for (int i = 0; i < n; i++) {
+        p[i] = x >> (8*i);
+    }
+}
+
+/* Drain the writer, mix the sound log into a WAV, and report. */
+static void
+capture_end(void)
+{
+    if (capture.pbo[0] && capture.frames) {
+        capture_collect(capture.pbo[capture.frames%2], TRUE);
+    }
+    capture.done = TRUE;
+    ReleaseSemaphore(capture.full, 1, 0);
+    WaitForSingleObject(capture.thread, INFINITE);
+    CloseHandle(capture.y4m);
+
+    long nsamples = capture.frames * AUDIO_HZ / FRAMERATE;
+    DWORD len = 44 + nsamples*2;
+    uint8_t *wav = win32_alloc(len);
+    memcpy(wav +  0, "RIFF", 4);
+    put_le(wav +  4, len - 8, 4);
+    memcpy(wav +  8, "WAVEfmt ", 8);
+    put_le(wav + 16, 16, 4);
+    put_le(wav + 20, 1, 2);                 // PCM
+    put_le(wav + 22, 1, 2);                 // mono
+    put_le(wav + 24, AUDIO_HZ, 4);
+    put_le(wav + 28, AUDIO_HZ*2, 4);
+    put_le(wav + 32, 2, 2);
+    put_le(wav + 34, 16, 2);
+    memcpy(wav + 36, "data", 4);
+    put_le(wav + 40, nsamples*2, 4);
+    int16_t *pcm = (int16_t *)(wav + 44);
+    for (int i = 0; i < capture.nsounds; i++) {
+        struct capture_event *s = capture.sounds + i;
+        for (int j = 0; j < s->len && s->sample + j < nsamples; j++) {
+            int x = pcm[s->sample + j] + s->pcm[j];
+            pcm[s->sample + j] = x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+        }
+    }
+
+    struct buf b = {.len = 0};
+    buf_str(&b, capture.name);
+    buf_str(&b, ".wav");
+    b.data[b.len] = 0;
+    if (!write_file(b.data, wav, len)) {
+        FATAL("Could not write capture audio");
+    }
+
+    b.len = 0;
+    buf_ll(&b, capture.frames, 0);
+    buf_str(&b, " frames, ");
+    buf_ll(&b, capture.dropped, 0);
+    buf_str(&b, " dropped, ");
+    buf_ll(&b, capture.written, 0);
+    buf_str(&b, " written\n");
+    buf_ll(&b, capture.nsounds, 0);
+    buf_str(&b, " sounds, ");
+    buf_ll(&b, nsamples, 0);
+    buf_str(&b, " samples\n");
+    buf_flush(&b, "Capture");
+}
+
+/* Score verification: each session file holds the RNG seed in hex, the
+ * claimed score, the build that recorded it (-sim), any options that
+ * change the simulation (-collide), then the controls bitmask for each
+ * 60 Hz tick as one hex digit, with whitespace ignored. A session is
+ * re-simulated headless in its own process, so that any number run in
+ * parallel, a bad one can't take down the verifier, and a job object
+ * reports its memory.
+ */
+enum replay_status {REPLAY_OK, REPLAY_MISMATCH, REPLAY_INVALID};
+
+static struct {
+    char *dir;
+    char *replay;
+    int jobs;
+} verify;
+
+/* Parse a session header at *P, advancing past it, and apply its
+ * options. Returns zero if it's malformed or from a different build,
+ * which can't be expected to reproduce its score.
+ */
+static int
+session_header(char **p, uint64_t *seed, long *claim)
+{
+    if (!parsehex(nextarg(p), seed) || (*claim = argtol(nextarg(p))) < 0) {
+        return 0;
+    }
+    int sim = 0;
+    collide.enabled = FALSE;
+    for (;;) {
+        while (ISSPACE(**p)) (*p)++;
+        if (**p != '-') return sim;
+        char *opt = nextarg(p);
+        if (!strcmp(opt, "-sim")) {
+            char *name = nextarg(p);
+            sim = name && !strcmp(name, SIM_NAME);
+        } else if (!strcmp(opt, "-collide")) {
+            collide.enabled = TRUE;
+        } else {
+            return 0;
+        }
+    }
+}
+
+/* Play a new game from the seed through the controls at P. Returns zero
+ * if they're malformed or longer than a recording can be.
+ */
+static int
+session_play(char *p)
+{
+    if (collide.enabled && !collide.order) {
+        collide_alloc(game.maxasteroids);
+    }
+    game_start();
+    game.last = 0;
+    for (long tick = 1; *p; p++) {
+        if (ISSPACE(*p)) continue;
+        int controls = *p >= '0' && *p <= '9' ? *p - '0' :
+                       *p >= 'a' && *p <= 'f' ? *p - 'a' + 10 : -1;
+        if (controls < 0 || tick > RECORD_MAX) return 0;
+        for (int c = 1; c <= I_FIRE; c <<= 1) {
+            if (controls & c) {
+                game_down(c);
+            } else {
+                game_up(c);
+            }
+        }
+        game_step((double)tick++ / FRAMERATE);
+        if (capture.name) {
+            game_render();
+            capture_frame();
+        }
+    }
+    return 1;
+}
+
+/* Re-simulate the session at PATH and compare against its claim. */
+static enum replay_status
+replay(char *path)
+{
+    DWORD len;
+    char *text = path ? read_file(path, &len, SESSION_MAX) : 0;
+    if (!text) return REPLAY_INVALID;
+    char *p = text;
+    uint64_t seed;
+    long claim;
+    if (!session_header(&p, &seed, &claim)) {
+        return REPLAY_INVALID;
+    }
+
+    game_alloc();
+    shapes_init();
+    if (capture.name) {
+        static uint8_t raster[CHECK_SIZE*CHECK_SIZE*3];
+        g_headless = TRUE;
+        g_raster = raster;
+        g_rsize = CHECK_SIZE;
+        g_init(CHECK_SIZE);
+        capture_begin(CHECK_SIZE, CHECK_SIZE, TRUE, FALSE);
+    }
+    game.seed = seed;
+    if (!session_play(p)) {
+        return REPLAY_INVALID;
+    }
+    if (capture.name) {
+        capture_end();
+    }
+    return game.score == claim ? REPLAY_OK : REPLAY_MISMATCH;
+}
+
+/* Start recording the game just started, with tick 0 at wall clock NOW. */
+static void
+record_begin(double now)
+{
+    if (!record.ticks) {
+        record.ticks = win32_alloc(RECORD_MAX);
+    }
+    record.enabled = TRUE;
+    record.saved = FALSE;
+    record.len = 0;
+    record.release = 0;
+    record.base = now;
+    game.last = 0;
+}
+
+/* Format the recording as session text in a new null-terminated buffer,
+ * returning its length through LEN.
+ */
+static char *
+record_text(DWORD *len)
+{
+    struct buf b = {0};
+    buf_hex(&b, game.seed);
+    buf_str(&b, " ");
+    buf_ll(&b, game.score, 0);
+    buf_str(&b, " -sim " SIM_NAME);
+    if (collide.enabled) {
+        buf_str(&b, " -collide");
+    }
+    buf_str(&b, "\n");
+
+    char *text = win32_alloc(b.len + record.len + record.len/64 + 2);
+    memcpy(text, b.data, b.len);
+    DWORD n = b.len;
+    for (long i = 0; i < record.len; i++) {
+        text[n++] = "0123456789abcdef"[record.ticks[i] & 15];
+        if (i%64 == 63 || i == record.len - 1) {
+            text[n++] = '\n';
+        }
+    }
+    text[n] = 0;
+    *len = n;
+    return text;
+}
+
+/* Write the session out once, claiming the current score. The log stops
+ * growing when full, so it's saved then, before the claim moves on.
+ */
+static void
+record_save(void)
+{
+    if (record.saved) return;
+    record.saved = TRUE;
+    DWORD len;
+    char *text = record_text(&len);
+    if (!write_file(record.path, text, len)) {
+        FATAL("Could not write session");
+    }
+    VirtualFree(text, 0, MEM_RELEASE);
+}
+
+/* Run one fixed tick, first applying input queued by wall clock WALL. A
+ * control pressed and released within the tick is held for one tick
+ * rather than lost.
+ */
+static void
+record_tick(double wall)
+{
+    for (int c = record.release; c; c &= c - 1) {
+        game_up(c & -c);
+    }
+    record.release = 0;
+    int pressed = 0;
+    for (struct input_event e; input_pop(&e, wall);) {
+        if (e.down) {
+            game_down(e.control);
+            pressed |= e.control;
+            record.release &= ~e.control;
+        } else if (pressed & e.control) {
+            record.release |= e.control;
+        } else {
+            game_up(e.control);
+        }
+    }
+    if (record.len < RECORD_MAX) {
+        record.ticks[record.len++] = game.controls;
+    }
+    game_step((double)(game.tick + 1) / FRAMERATE);
+    if (record.len == RECORD_MAX && record.path) {
+        record_save();
+    }
+}
+
+/* Run the ticks due by wall clock NOW. After a stall, the clock slips
+ * rather than the game catching up in one burst.
+ */
+static void
+record_run(double now)
+{
+    long long tick = game.tick;
+    long long due = (now - record.base) * FRAMERATE;
+    if (due - tick > RECORD_BURST) {
+        due = tick + RECORD_BURST;
+        record.base = now - (double)due/FRAMERATE;
+    }
+    for (; tick < due; tick++) {
+        record_tick(record.base + (double)(tick + 1)/FRAMERATE);
+    }
+}
+
+/* Record a scripted session through the input queue, including taps
+ * shorter than a tick, in -collide mode so that the header must carry
+ * it. Then replay the session text, which must reach the same score and
+ * state. Returns non-zero on any difference.
+ */
+static int
+check_record(struct buf *b)
+{
+    BOOL collide_was = collide.enabled;
+    collide.enabled = TRUE;
+    if (!collide.order) {
+        collide_alloc(game.maxasteroids);
+    }
+    game.seed = 4;
+    game_start();
+    double freq = counter_freq();
+    record_begin(counter_now() / freq);
+    for (int t = 0; t < 1800; t++) {
+        if (t%180 ==   0) input_push(I_TURNL, TRUE);
+        if (t%180 ==  60) input_push(I_TURNL, FALSE);
+        if (t%240 == 100) input_push(I_THRUST, TRUE);
+        if (t%240 == 130) input_push(I_THRUST, FALSE);
+        if (t%7 == 0) {
+            input_push(I_FIRE, TRUE);
+            input_push(I_FIRE, FALSE);
+        }
+        record_tick(counter_now() / freq);
+    }
+    record.enabled = FALSE;
+    long long score = game.score;
+    uint64_t state = game_hash();
+
+    DWORD len;
+    char *text = record_text(&len);
+    char *p = text;
+    uint64_t seed;
+    long claim;
+    collide.enabled = FALSE;
+    int fail = !session_header(&p, &seed, &claim) || !collide.enabled;
+    if (!fail) {
+        game.seed = seed;
+        fail = !session_play(p);
+    }
+    fail |= claim != score || game.score != score || game_hash() != state;
+    VirtualFree(text, 0, MEM_RELEASE);
+    collide.enabled = collide_was;
+
+    buf_str(b, "record    ");
+    buf_hex(b, state);
+    buf_str(b, "  score ");
+    buf_ll(b, score, 0);
+    buf_str(b, fail ? "  REPLAY\n" : "  ok\n");
+    return fail;
+}
+
+/* List a failed session in the report, flushing before it fills. */
+static void
+verify_note(struct buf *b, enum replay_status status, const char *name)
+{
+    buf_str(b, status == REPLAY_MISMATCH ? "MISMATCH " : "INVALID  ");
+    buf_str(b, name);
+    buf_str(b, "\n");
+    if (b->len > COUNTOF(b->data) - MAX_PATH - 16) {
+        buf_flush(b, "Verify Results");
+    }
+}
+
+/* Replay every session in the directory through a bounded pool of
+ * worker processes. A worker still running after VERIFY_TIMEOUT is
+ * killed and its session counted invalid. Returns non-zero if any
+ * session fails.
+ */
+#define VERIFY_TIMEOUT 60  // seconds of wall clock per session
+
+static int
+verify_run(void)
+{
+    char exe[MAX_PATH];
+    GetModuleFileNameA(0, exe, sizeof(exe));
+    int jobs = verify.jobs;
+    if (!jobs) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        jobs = info.dwNumberOfProcessors;
+    }
+    jobs = jobs < MAXIMUM_WAIT_OBJECTS ? jobs : MAXIMUM_WAIT_OBJECTS;
+
+    // Workers die with the verifier
+    HANDLE job = CreateJobObjectA(0, 0);
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limit = {0};
+    limit.BasicLimitInformation.LimitFlags =
+        JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(job, JobObjectExtendedLimitInformation,
+                            &limit, sizeof(limit));
+
+    char pattern[MAX_PATH];
+    struct buf b = {0};
+    buf_str(&b, verify.dir);
+    buf_str(&b, "\\*");
+    if (b.len >= MAX_PATH) FATAL("Session directory path too long");
+    memcpy(pattern, b.data, b.len);
+    pattern[b.len] = 0;
+    b.len = 0;
+
+    WIN32_FIND_DATAA fd;
+    HANDLE find = FindFirstFileA(pattern, &fd);
+    BOOL more = find != INVALID_HANDLE_VALUE;
+
+    HANDLE procs[MAXIMUM_WAIT_OBJECTS];
+    char names[MAXIMUM_WAIT_OBJECTS][MAX_PATH];
+    double deadlines[MAXIMUM_WAIT_OBJECTS];
+    int running = 0;
+    long counts[3] = {0};
+    long sessions = 0;
+    double freq = counter_freq();
+    double start = counter_now();
+    for (;;) {
+        for (; more && running < jobs; more = FindNextFileA(find, &fd)) {
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            char cmd[3*MAX_PATH];
+            struct buf c = {0};
+            buf_str(&c, "\"");
+            buf_str(&c, exe);
+            buf_str(&c, "\" -replay \"");
+            buf_str(&c, verify.dir);
+            buf_str(&c, "\\");
+            buf_str(&c, fd.cFileName);
+            buf_str(&c, "\"");
+            if (c.len >= COUNTOF(cmd)) {
+                sessions++;  // path too long to pass to a worker
+                counts[REPLAY_INVALID]++;
+                verify_note(&b, REPLAY_INVALID, fd.cFileName);
+                continue;
+            }
+            memcpy(cmd, c.data, c.len);
+            cmd[c.len] = 0;
+
+            STARTUPINFOA si = {.cb = sizeof(si)};
+            PROCESS_INFORMATION pi;
+            if (!CreateProcessA(exe, cmd, 0, 0, FALSE, CREATE_SUSPENDED,
+                                0, 0, &si, &pi)) {
+                FATAL("Could not start a verification worker");
+            }
+            AssignProcessToJobObject(job, pi.hProcess);
+            ResumeThread(pi.hThread);
+            CloseHandle(pi.hThread);
+            procs[running] = pi.hProcess;
+            memcpy(names[running], fd.cFileName, sizeof(names[0]));
+            deadlines[running] = counter_now()/freq + VERIFY_TIMEOUT;
+            running++;
+        }
+        if (!running) break;
+
+        // Kill overdue workers, collected below with an invalid status
+        double now = counter_now() / freq;
+        double next = now + VERIFY_TIMEOUT;
+        for (int i = 0; i < running; i++) {
+            if (deadlines[i] <= now) {
+                TerminateProcess(procs[i], REPLAY_INVALID);
+                deadlines[i] = now + VERIFY_TIMEOUT;
+            }
+            next = deadlines[i] < next ? deadlines[i] : next;
+        }
+        DWORD wait = (next - now)*1000 + 1;
+        DWORD r = WaitForMultipleObjects(running, procs, FALSE, wait);
+        if (r == WAIT_TIMEOUT) continue;
+        int i = r - WAIT_OBJECT_0;
+        DWORD status;
+        if (!GetExitCodeProcess(procs[i], &status) ||
+            status > REPLAY_INVALID) {
+            status = REPLAY_INVALID;  // crashed
+        }
+        CloseHandle(procs[i]);
+        sessions++;
+        counts[status]++;
+        if (status != REPLAY_OK) {
+            verify_note(&b, status, names[i]);
+        }
+        running--;
+        procs[i] = procs[running];
+        memcpy(names[i], names[running], sizeof(names[0]));
+        deadlines[i] = deadlines[running];
+    }
+    double seconds = (counter_now() - start) / freq;
+    if (find != INVALID_HANDLE_VALUE) {
+        FindClose(find);
+    }
+    QueryInformationJobObject(job, JobObjectExtendedLimitInformation,
+                              &limit, sizeof(limit), 0);
+    CloseHandle(job);
+
+    buf_str(&b, "sessions ");
+    buf_ll(&b, sessions, 0);
+    buf_str(&b, ", verified ");
+    buf_ll(&b, counts[REPLAY_OK], 0);
+    buf_str(&b, ", mismatched ");
+    buf_ll(&b, counts[REPLAY_MISMATCH], 0);
+    buf_str(&b, ", invalid ");
+    buf_ll(&b, counts[REPLAY_INVALID], 0);
+    buf_str(&b, "\nworkers ");
+    buf_ll(&b, jobs, 0);
+    buf_str(&b, ", sessions/s ");
+    buf_ll(&b, seconds > 0 ? sessions / seconds : 0, 0);
+    buf_str(&b, ", peak KiB/session ");
+    buf_ll(&b, limit.PeakProcessMemoryUsed >> 10, 0);
+    buf_str(&b, "\n");
+    buf_flush(&b, "Verify Results");
+    return sessions != counts[REPLAY_OK];
+}
+
+/* Append a non-negative quantity scaled by 1e9, e.g. an error or a
+ * duration in seconds, as an integer count of nano-units.
+ */
+static void
+buf_nano(struct buf *b, double x, int width)
+{
+    buf_ll(b, x*1e9 + 0.5, width);
+}
+
+/* Check the math kernels against libm and compare their speed. Returns
+ * non-zero if any kernel exceeds its error budget.
+ */
+static int
+mathcheck(void)
+{
+    static float a[1<<12], c[COUNTOF(a)], s[COUNTOF(a)];
+    struct buf b = {0};
+    int fail = 0;
+
+    double wrap_err = 0, wrapv_err = 0;
+    for (int i = -(1<<20); i <= 1<<20; i += COUNTOF(a)) {
+        for (int j = 0; j < COUNTOF(a); j++) {
+            a[j] = (i + j)*0x1p-16f + randu()*0x1p-16f;
+            c[j] = a[j];
+        }
+        wrapv(c, COUNTOF(c));
+        for (int j = 0; j < COUNTOF(a); j++) {
+            float x = a[j];
+            float r = wrap(x);
+            float want = x - floorf(x);
+            want = want < 1 ? want : 0;
+            if (!(r >= 0 && r < 1)) fail = 1;
+            double err = fabsf(r - want);
+            wrap_err = err > wrap_err ? err : wrap_err;
+            err = fabsf(c[j] - r);
+            wrapv_err = err > wrapv_err ? err : wrapv_err;
+        }
+    }
+    for (int i = 0; i < 1<<20; i++) {
+        float r = randu();
+        if (!(r >= 0 && r < 1)) fail = 1;
+    }
+    fail |= wrap_err != 0 || wrapv_err != 0;
+
+    // Batches must match scalar draws exactly at any length and offset
+    double fill_err = 0;
+    for (int n = 0; n < 1<<8; n++) {
+        struct stream x = stream_key(n, STREAM_TICK, n);
+        x.n = n * 0x9e3779b9;
+        struct stream y = x;
+        stream_fill(&x, a, n);
+        for (int i = 0; i < n; i++) {
+            double err = fabsf(a[i] - stream_f(&y));
+            fill_err = err > fill_err ? err : fill_err;
+        }
+        fail |= x.n != y.n;
+    }
+    fail |= fill_err != 0;
+
+    // Vector hash lanes must match the scalar lanes at any alignment
+    double hash_err = 0;
+    for (int n = 0; n < 1<<10; n++) {
+        const unsigned char *p = (unsigned char *)a + n%16;
+        uint32_t x[HASHV_LANES];
+        for (int i = 0; i < HASHV_LANES; i++) {
+            x[i] = HASHV_INIT + i;
+        }
+        int i = 0;
+        for (; i+HASHV_BLOCK <= n; i += HASHV_BLOCK) {
+            hashv_block(x, p + i);
+        }
+        uint64_t want = hashv_fold(n, x, p + i, n - i);
+        hash_err += hashv(n, p, n) != want;
+    }
+    fail |= hash_err != 0;
+
+    double cis_err = 0, cisv_err = 0;
+    for (int n = 0; n < 1<<8; n++) {
+        for (int i = 0; i < COUNTOF(a); i++) {
+            a[i] = (randu()*2 - 1) * 4096;
+        }
+        cisv(c, s, a, COUNTOF(a));
+        for (int i = 0; i < COUNTOF(a); i++) {
+            struct v2 v = cis(a[i]);
+            double x = a[i];
+            double ec = fabs((double)v.x - cos(x));
+            double es = fabs((double)v.y - sin(x));
+            double e = ec > es ? ec : es;
+            cis_err = e > cis_err ? e : cis_err;
+            ec = fabs((double)c[i] - cos(x));
+            es = fabs((double)s[i] - sin(x));
+            e = ec > es ? ec : es;
+            cisv_err = e > cisv_err ? e : cisv_err;
+        }
+    }
+    double budget = CIS_MAX_ERROR;
+    fail |= cis_err > budget || cisv_err > budget;
+
+    buf_str(&b, "kernel  max error (1e-9)\n");
+    buf_str(&b, "wrap");
+    buf_nano(&b, wrap_err, 21);
+    buf_str(&b, "\nwrapv");
+    buf_nano(&b, wrapv_err, 20);
+    buf_str(&b, "\ncis");
+    buf_nano(&b, cis_err, 22);
+    buf_str(&b, "\ncisv");
+    buf_nano(&b, cisv_err, 21);
+    buf_str(&b, "\nstream_fill");
+    buf_nano(&b, fill_err, 14);
+    buf_str(&b, "\nhashv");
+    buf_nano(&b, hash_err, 20);
+    buf_str(&b, "\nbudget");
+    buf_nano(&b, budget, 19);
+    buf_str(&b, fail ? "\nFAIL\n\n" : "\nPASS\n\n");
+
+    // Microbenchmarks over the same angles, which stay in cache
+    enum {
+        LIBM_WRAP, WRAP, WRAPV, LIBM_SINCOS, CISV, RANDU, FILL,
+        HASH64, HASHV, NBENCH
+    };
+    static const char names[][12] = {
+        "fmodf", "wrap", "wrapv", "cosf+sinf", "cisv",
+        "randu", "stream_fill", "hash64", "hashv"
+    };
+    double freq = counter_freq();
+    volatile float sink = 0;
+    int reps = 1<<8;
+    buf_str(&b, "kernel       ns/op (1e-3)\n");
+    for (int k = 0; k < NBENCH; k++) {
+        double start = counter_now();
+        for (int n = 0; n < reps; n++) {
+            float sum = 0;
+            switch (k) {
+            case LIBM_WRAP:
+                for (int i = 0; i < COUNTOF(a); i++) {
+                    sum += fmodf(a[i]*1e-3f + 1, 1);
+                }
+                break;
+            case WRAP:
+                for (int i = 0; i < COUNTOF(a); i++) {
+                    sum += wrap(a[i]*1e-3f);
+                }
+                break;
+            case WRAPV:
+                for (int i = 0; i < COUNTOF(a); i++) {
+                    s[i] = a[i]*1e-3f;
+                }
+                wrapv(s, COUNTOF(s));
+                sum += s[n];
+                break;
+            case LIBM_SINCOS:
+                for (int i = 0; i < COUNTOF(a); i++) {
+                    sum += cosf(a[i]) + sinf(a[i]);
+                }
+                break;
+            case CISV:
+                cisv(c, s, a, COUNTOF(a));
+                sum += c[n] + s[n];
+                break;
+            case RANDU:
+                for (int i = 0; i < COUNTOF(a); i++) {
+                    sum += randu();
+                }
+                break;
+            case FILL:
+                stream_fill(&rng, c, COUNTOF(c));
+                sum += c[n];
+                break;
+            case HASH64:
+                sum += hash64(HASH_INIT, a, sizeof(a)) >> 40;
+                break;
+            case HASHV:
+                sum += hashv(HASH_INIT, a, sizeof(a)) >> 40;
+                break;
+            }
+            sink += sum;
+        }
+        double ns = (counter_now() - start) / freq / reps / COUNTOF(a);
+        buf_str(&b, names[k]);
+        buf_ll(&b, ns*1e12, 24 - (int)strlen(names[k]));
+        buf_str(&b, "\n");
+    }
+    buf_flush(&b, "Math Check");
+    return fail;
+}
+
+/* Time the collision pass for growing asteroid counts at constant
+ * density, where it should scale near linearly, and check its contacts
+ * against brute force. Returns non-zero if any contact is missed.
+ */
+static int
+collide_bench(void)
+{
+    enum {MAXN = 1<<16, BRUTEN = 1<<13, TICKS = 60};
+    struct buf b = {0};
+    int fail = 0;
+    double freq = counter_freq();
+    collide.enabled = TRUE;
+    game.asteroids = win32_alloc(MAXN * sizeof(*game.asteroids));
+    game.maxasteroids = MAXN;
+    collide_alloc(MAXN);
+
+    buf_str(&b, "asteroids   ns/tick  ns/asteroid  tests/asteroid  "
+                "moves/asteroid  brute ns/tick\n");
+    for (int n = 1<<10; n <= MAXN; n *= 2) {
+        game.nasteroids = collide.n = 0;
+        struct stream r = stream_key(n, STREAM_LEVEL, 0);
+        for (int i = 0; i < n; i++) {
+            struct asteroid *a = game.asteroids + game_asteroid(A0, &r);
+            float f = sqrtf(16.0f / n);
+            a->scale = ASTEROID0_MAX * f;
+            a->dx = velocity_scale(a->dx, f);
+            a->dy = velocity_scale(a->dy, f);
+        }
+        game_collide();
+
+        float dt = 1.0f / FRAMERATE;
+        long long tests = 0;
+        double time = 0;
+        collide.moves = 0;
+        for (int t = 0; t < TICKS; t++) {
+            for (int i = 0; i < n; i++) {
+                struct asteroid *a = game.asteroids + i;
+                a->x = coord_move(a->x, a->dx, dt);
+                a->y = coord_move(a->y, a->dy, dt);
+            }
+            double start = counter_now();
+            tests += game_collide();
+            time += counter_now() - start;
+        }
+
+        buf_ll(&b, n, 9);
+        buf_ll(&b, 1e9 * time / freq / TICKS, 10);
+        buf_ll(&b, 1e9 * time / freq / TICKS / n, 13);
+        buf_ll(&b, tests / TICKS / n, 16);
+        buf_ll(&b, collide.moves / TICKS / n, 16);
+        if (n <= BRUTEN) {
+            collide.contacts = 0;
+            game_collide();
+            long long contacts = 0;
+            double start = counter_now();
+            for (int i = 0; i < n; i++) {
+                struct asteroid *a = game.asteroids + i;
+                for (int j = i + 1; j < n; j++) {
+                    struct asteroid *c = game.asteroids + j;
+                    float dx = torus_delta(coord_delta(c->x, a->x));
+                    float dy = torus_delta(coord_delta(c->y, a->y));
+                    float r = a->scale + c->scale;
+                    float d2 = dx*dx + dy*dy;
+                    contacts += d2 < r*r && d2 != 0;
+                }
+            }
+            double brute = counter_now() - start;
+            fail |= contacts != collide.contacts;
+            buf_ll(&b, 1e9 * brute / freq, 15);
+            buf_str(&b, contacts != collide.contacts ? "  MISMATCH" : "");
+        } else {
+            buf_str(&b, "              -");
+        }
+        buf_str(&b, "\n");
+    }
+    buf_flush(&b, "Collision Benchmark");
+    return fail;
+}
+
+/* Show input-to-simulation latency since the last report. */
+static void
+input_report(HWND wnd)
+{
+    struct buf b = {.len = 0};
+    buf_str(&b, "Asteroids - input latency ");
+    if (input.latency_count) {
+        double avg = input.latency_sum / input.latency_count;
+        buf_ll(&b, avg*1e6 + 0.5, 0);
+        buf_str(&b, " us avg, ");
+        buf_ll(&b, input.latency_max*1e6 + 0.5, 0);
+        buf_str(&b, " us max");
+    } else {
+        buf_str(&b, "idle");
+    }
+    b.data[b.len] = 0;
+    SetWindowText(wnd, b.data);
+    input.latency_sum = input.latency_max = 0;
+    input.latency_count = 0;
+}
+
+static void
+args_parse(char *cmd)
+{
+    for (char *arg; (arg = nextarg(&cmd));) {
+        int *opt = 0;
+        long min = 0, max = STRESS_MAX;
+        if (!strcmp(arg, "-stress")) {
+            stress.enabled = TRUE;
+        } else if (!strcmp(arg, "-check") || !strcmp(arg, "-checkinit")) {
+            check.init = !strcmp(arg, "-checkinit");
+            if (!(check.baseline = nextarg(&cmd))) {
+                FATAL("-check and -checkinit require a baseline file");
+            }
+        } else if (!strcmp(arg, "-threshold")) {
+            opt = &check.threshold;
+            max = 1000;
+        } else if (!strcmp(arg, "-verify")) {
+            if (!(verify.dir = nextarg(&cmd))) {
+                FATAL("-verify requires a session directory");
+            }
+        } else if (!strcmp(arg, "-jobs")) {
+            opt = &verify.jobs;
+            max = MAXIMUM_WAIT_OBJECTS;
+        } else if (!strcmp(arg, "-replay")) {
+            if (!(verify.replay = nextarg(&cmd))) {
+                FATAL("-replay requires a session file");
+            }
+        } else if (!strcmp(arg, "-record")) {
+            if (!(record.path = nextarg(&cmd))) {
+                FATAL("-record requires a session file");
+            }
+        } else if (!strcmp(arg, "-capture")) {
+            if (!(capture.name = nextarg(&cmd))) {
+                FATAL("-capture requires a file name");
+            }
+        } else if (!strcmp(arg, "-mathcheck")) {
+            ExitProcess(mathcheck());
+        } else if (!strcmp(arg, "-collidebench")) {
+            ExitProcess(collide_bench());
+        } else if (!strcmp(arg, "-collide")) {
+            collide.enabled = TRUE;
+        } else if (!strcmp(arg, "-nolod")) {
+            g_nolod = TRUE;
+        } else if (!strcmp(arg, "-nogpu")) {
+            g_nogpu = TRUE;
+        } else if (!strcmp(arg, "-publish")) {
+            publish.enabled = TRUE;
+        } else if (!strcmp(arg, "-spectate")) {
+            publish.spectate = TRUE;
+        } else if (!strcmp(arg, "-latency")) {
+            input.show = TRUE;
+        } else if (!strcmp(arg, "-asteroids")) {
+            opt = &stress.nasteroids;
+        } else if (!strcmp(arg, "-shots")) {
+            opt = &stress.nshots;
+        } else if (!strcmp(arg, "-debris")) {
+            opt = &stress.ndebris;
+        } else if (!strcmp(arg, "-seconds")) {
+            opt = &stress.seconds;
+            min = 1;
+            max = STRESS_MAX_SECONDS;
+        } else {
+            FATAL("usage: asteroids [-stress] [-asteroids N] [-shots N] "
+                  "[-debris N] [-seconds N] [-nolod] [-nogpu] "
+                  "[-latency] [-publish] [-spectate] [-collide] "
+                  "[-collidebench] [-mathcheck] [-verify DIR] [-jobs N] "
+                  "[-record SESSION] [-replay SESSION] [-capture NAME] "
+                  "[-check BASELINE] [-checkinit BASELINE] "
+                  "[-threshold PERCENT]");
+        }
+        if (opt) {
+            long n = argtol(nextarg(&cmd));
+            if (n < min || n > max) {
+                FATAL("Invalid numeric argument");
+            }
+            *opt = n;
+        }
+    }
+}
+
+int WINAPI
+WinMain(HINSTANCE h, HINSTANCE prev, LPSTR cmd, int show)
+{
+    (void)h; (void)prev; (void)show;
+
+    args_parse(cmd);
+    if (check.baseline) {
+        ExitProcess(check_run());
+    }
+    if (verify.dir) {
+        ExitProcess(verify_run());
+    }
+    if (verify.replay) {
+        // Nobody watches a worker, so fail rather than wait on a dialog
+        SetErrorMode(SEM_FAILCRITICALERRORS | SEM_NOGPFAULTERRORBOX);
+        fatal_quiet = REPLAY_INVALID;
+        ExitProcess(replay(verify.replay));
+    }
+    if (publish.spectate) {
+        ExitProcess(spectate_run());
+    }
+
+    HWND wnd = win32_window_init();
+    if (publish.enabled) {
+        publish_init();
+    }
+
+    if (stress.enabled) {
+        stress_run(GetDC(wnd));
+        ExitProcess(0);
+    }
+
+    sound_init(wnd);
+
+    input_init(wnd);
+
+    timeBeginPeriod(1);
+    double freq = counter_freq();
+    if (record.path) {
+        record_begin(counter_now() / freq);
+    }
+
+    HDC hdc = GetDC(wnd);
+    for (long frame = 1;; frame++) {
+        double start = counter_now();
+
+        MSG msg;
+        while (PeekMessage(&msg, 0, 0, 0, TRUE)) {
+            if (msg.message == WM_QUIT) {
+                if (record.enabled) {
+                    record_save();
+                }
+                if (capture.thread) {
+                    capture_end();
+                }
+                TerminateProcess(GetCurrentProcess(), 0);
+            }
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
 
         if (win32_opengl_initialized) {
-            joystick_read(joysticks);
-            game_step();
+            if (record.enabled) {
+                record_run(start / freq);
+            } else {
+                game_step(start / freq);
+            }
+            if (publish.enabled) {
+                publish_tick();
+            }
+            if (input.show && frame % FRAMERATE == 0) {
+                input_report(wnd);
+            }
             game_render();
+            if (capture.name) {
+                if (!capture.thread) {
+                    RECT r;
+                    GetClientRect(wnd, &r);
+                    capture_begin(r.right - r.left, r.bottom - r.top,
+                                  FALSE, TRUE);
+                }
+                capture_frame();
+            }
             SwapBuffers(hdc);
 
             // Some systems have a broken swap interval (virtual machines,